@@ -0,0 +1,15 @@
+// ack.c - deep recursion: Ackermann's function
+
+int ack(int m, int n)
+{
+  if (m == 0) return n + 1;
+  if (n == 0) return ack(m - 1, 1);
+  return ack(m - 1, ack(m, n - 1));
+}
+
+int main()
+{
+  printf("ack(2, 2000) = %d\n", ack(2, 2000));
+  printf("ack(3, 7) = %d\n", ack(3, 7));
+  return 0;
+}
@@ -0,0 +1,74 @@
+// measure.c - run a command and report what it cost, for bench/run.sh
+//
+// usage: measure command [args...]
+//
+// The command's output goes where measure's goes.  When it exits, one line
+// goes to stderr:
+//
+//   wall_us instructions max_rss_kb
+//
+// with "-" for the instruction count when perf events are not available
+// (no PMU, a container, perf_event_paranoid).  The counter is opened on the
+// stopped child and enabled by its exec, so only the command is counted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+int main(int argc, char **argv)
+{
+  struct rusage ru;
+  struct timespec t0, t1;
+  long long n;
+  int go[2], pid, st, fd;
+  char c;
+
+  if (argc < 2) { fprintf(stderr, "usage: measure command [args...]\n"); return 2; }
+  if (pipe(go)) { perror("pipe"); return 2; }
+  if ((pid = fork()) < 0) { perror("fork"); return 2; }
+  if (!pid) { // wait for the counter, then become the command
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1) _exit(127);
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+  close(go[0]);
+
+  fd = -1;
+#if defined(__linux__)
+  {
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.size = sizeof(pe);
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.config = PERF_COUNT_HW_INSTRUCTIONS;
+    pe.disabled = 1;
+    pe.enable_on_exec = 1;
+    pe.inherit = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    fd = syscall(SYS_perf_event_open, &pe, pid, -1, -1, 0);
+  }
+#endif
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (write(go[1], "", 1) != 1) { perror("write"); return 2; }
+  close(go[1]);
+  if (wait4(pid, &st, 0, &ru) < 0) { perror("wait4"); return 2; }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  fprintf(stderr, "%lld ", (t1.tv_sec - t0.tv_sec) * 1000000LL + (t1.tv_nsec - t0.tv_nsec) / 1000);
+  if (fd >= 0 && read(fd, &n, sizeof(n)) == sizeof(n)) fprintf(stderr, "%lld ", n); else fprintf(stderr, "- ");
+  fprintf(stderr, "%ld\n", ru.ru_maxrss);
+  return WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+}
@@ -0,0 +1,16 @@
+// printf.c - output-heavy: formatted lines and single characters
+
+int main()
+{
+  int i, j;
+
+  i = 0;
+  while (i < 100000) { printf("%d: %s %x %5d|%-4d|\n", i, "line", i * 7, i % 1000, i & 15); ++i; }
+  i = 0;
+  while (i < 2000) {
+    j = 0; while (j < 200) { putchar('a' + (i + j) % 26); ++j; }
+    putchar('\n');
+    ++i;
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# run.sh - build c4 and measure it on a fixed set of workloads
+#
+# usage: bench/run.sh [c4.c] [runs] [c4 flags...]
+#
+# Builds c4.c (default: the one next to this directory) and measure.c with
+# ${CC:-cc} -O2, runs every workload `runs` times (default 5) with the given
+# flags (-j, -r, ...) and prints one tab-separated line per workload:
+#
+#   workload  wall_ms  cycles  instructions  max_rss_kb
+#
+# Each column is the lowest of the runs.  cycles is the VM cycle count c4
+# reports on exit (the outermost c4 for the self-hosting chain, "-" under
+# -j), instructions is "-" where perf events are not available.  Keep the
+# output of two commits and compare them:
+#   bench/run.sh > old.tsv; git checkout ...; bench/run.sh > new.tsv
+#
+# Workloads:
+#   self    c4 compiling c4 compiling hello.c (c4 c4.c c4.c hello.c)
+#   lex     compiling a generated 45000 line source, the lexer and parser
+#   fib     recursive calls, fib(30)
+#   ack     deep recursion, Ackermann's function
+#   sieve   pointer and array loops, a prime sieve and a matrix product
+#   printf  formatted output and putchar
+
+dir=$(cd "$(dirname "$0")" && pwd)
+src=${1:-$dir/../c4.c}
+runs=${2:-5}
+[ $# -gt 2 ] && shift 2 || set --
+tmp=${TMPDIR:-/tmp}/c4_bench.$$
+mkdir -p $tmp || exit 1
+trap 'rm -rf $tmp' EXIT
+
+${CC:-cc} -O2 -w -o $tmp/c4 "$src" || { echo "could not build $src"; exit 1; }
+${CC:-cc} -O2 -o $tmp/measure "$dir/measure.c" || { echo "could not build measure.c"; exit 1; }
+
+cat > $tmp/hello.c <<'SRC'
+int main()
+{
+  printf("hello, world\n");
+  return 0;
+}
+SRC
+
+awk 'BEGIN {
+  for (i = 0; i < 5000; i++) {
+    printf "// f%d mixes a few operators, constants and a string\n", i
+    printf "int f%d(int a, int b)\n{\n  int x;\n", i
+    printf "  x = a * %d + b - (a << 2) + 0x%x;\n", i, i
+    printf "  if (x > %d && b != a) x = x %% 1000 + \"literal %d\"[0];\n", i, i
+    printf "  return x;\n}\n\n"
+  }
+  printf "int main()\n{\n  return f4999(1, 2) & 0;\n}\n"
+}' > $tmp/lex.c
+
+bench() { # name, c4 arguments
+  name=$1; shift
+  i=0
+  while [ $i -lt $runs ]; do
+    "$tmp/measure" "$tmp/c4" "$@" > $tmp/out 2> $tmp/cost || { echo "$name failed:"; tail -3 $tmp/out; exit 1; }
+    echo "$(tail -1 $tmp/cost) $(tail -1 $tmp/out | grep -o 'cycle = [0-9]*' | cut -d' ' -f3)"
+    i=$((i + 1))
+  done | awk -v name=$name '
+    function low(a, b) { return a == "" ? b : b == "-" || b == "" ? a : a == "-" || b + 0 < a + 0 ? b : a }
+    { w = low(w, $1); n = low(n, $2); r = low(r, $3); c = low(c, $4) }
+    END { printf "%s\t%.1f\t%s\t%s\t%s\n", name, w / 1000, c == "" ? "-" : c, n, r }'
+}
+
+printf "workload\twall_ms\tcycles\tinstructions\tmax_rss_kb\n"
+bench self "$@" "$src" "$src" $tmp/hello.c
+bench lex "$@" $tmp/lex.c
+bench fib "$@" "$dir/fib.c"
+bench ack "$@" "$dir/ack.c"
+bench sieve "$@" "$dir/sieve.c"
+bench printf "$@" "$dir/printf.c"
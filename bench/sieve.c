@@ -0,0 +1,50 @@
+// sieve.c - pointer and array loops: a prime sieve and a matrix product
+
+int sieve(int n)
+{
+  char *s, *p, *q;
+  int c;
+
+  s = malloc(n);
+  memset(s, 1, n);
+  c = 0; p = s + 2;
+  while (p < s + n) {
+    if (*p) {
+      ++c;
+      q = p + (p - s);
+      while (q < s + n) { *q = 0; q = q + (p - s); }
+    }
+    ++p;
+  }
+  free(s);
+  return c;
+}
+
+int matmul(int n)
+{
+  int *a, *b, *c, i, j, k, t;
+
+  a = malloc(n * n * sizeof(int)); b = malloc(n * n * sizeof(int)); c = malloc(n * n * sizeof(int));
+  i = 0; while (i < n * n) { a[i] = i % 7; b[i] = i % 5; ++i; }
+  i = 0;
+  while (i < n) {
+    j = 0;
+    while (j < n) {
+      t = 0; k = 0;
+      while (k < n) { t = t + a[i * n + k] * b[k * n + j]; ++k; }
+      c[i * n + j] = t;
+      ++j;
+    }
+    ++i;
+  }
+  t = 0; i = 0; while (i < n * n) { t = t + c[i]; ++i; }
+  free(a); free(b); free(c);
+  return t;
+}
+
+int main()
+{
+  printf("primes below 2000000: %d\n", sieve(2000000));
+  printf("matmul(64) checksum: %d\n", matmul(64));
+  return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# startup.sh - time many short c4 runs, where startup dominates
+#
+# usage: bench/startup.sh [c4 binary] [runs]
+#
+# Compiles and runs a hello world program `runs` times (default 1000) and
+# prints the average wall time per run.  Build c4 first, for example with
+#   gcc -O2 -o c4 c4.c
+
+c4=${1:-./c4}
+runs=${2:-1000}
+tmp=${TMPDIR:-/tmp}/c4_startup.$$
+trap 'rm -f $tmp.c' EXIT
+
+cat > $tmp.c <<'SRC'
+int main()
+{
+  printf("hello, world\n");
+  return 0;
+}
+SRC
+
+"$c4" $tmp.c > /dev/null || { echo "$c4 failed on $tmp.c"; exit 1; }
+
+start=$(date +%s%N)
+i=0
+while [ $i -lt $runs ]; do
+  "$c4" $tmp.c > /dev/null
+  i=$((i + 1))
+done
+end=$(date +%s%N)
+
+echo "$runs runs: $(( (end - start) / runs / 1000 )) us per run"
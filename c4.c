@@ -1,7 +1,7 @@
 // c4.c - C in four functions
 
 // char, int, and pointer types
-// if, while, return, and expression statements
+// if, while, for, switch, break, return, and expression statements
 // just enough features to allow self-compilation and a bit more
 
 // Written by Robert Swierczek
@@ -11,33 +11,140 @@
 #include <memory.h>
 #include <unistd.h>
 #include <fcntl.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#define C4_HOST 1 // mmap/calloc versions of load() and zalloc(), see c4_host.h
+#endif
+#if defined(__GNUC__) && !defined(C4_PORTABLE)
+#include <stdint.h> // int32_t for -z and the JIT
+#endif
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32) && !defined(C4_PORTABLE)
+#include <sys/mman.h>
+#define C4_JIT 1 // -j compiles to native x86-64 code, see c4_jit.h
+#endif
 #define int long long
 
+#if defined(__GNUC__) && !defined(C4_PORTABLE)
+#define C4_THREADED 1 // computed-goto VM dispatch, see c4_threaded.h (-DC4_PORTABLE keeps the switch in vm() only)
+#endif
+
 char *p, *lp, // current position in source code
-     *data;   // data/bss pointer
+     *data,   // data/bss pointer
+     *dmax,   // end of the current data chunk (less room for a string terminator)
+     *lit,    // start of the string literal being lexed
+     *rp,     // literal area: next free byte of the current chunk
+     *rmax,   // end of the literal chunk
+     *opn,    // opcode names, 5 characters each
+     *fold,   // -P: file the sampled stacks are written to
+     *stats,  // --stats: file the run's statistics are written to as JSON
+     *fname,  // name of the file being compiled, for the diagnostics
+     *narg,   // arguments each library function takes as a digit, 0 for printf
+     *ob,     // guest output buffer, flushed by EXIT, read() and write() and when full
+     *obp,    // next free byte in ob
+     *obx,    // end of ob, followed by scratch room for number digits
+     *gp,     // guest heap: next free byte of the current arena chunk
+     *gx,     // end of the arena chunk
+     *dtag;   // after flat(): 1 for each text word that holds a data address
 
 int *e, *le,  // current position in emitted code
+    *text,    // start of emitted code
+    *tb,      // start of the current text chunk
+    *tmax,    // end of the current text chunk, less the room checked for in expr()/stmt()
+    xd,       // expr() nesting depth
+    *tcl,     // finished text chunks as (start, last word) pairs, up to tcp
+    *tcp,
+    tsz,      // words in the current text chunk
+    dsz,      // bytes in the current data chunk
+    *dcl,     // data chunks as (start, end) pairs, up to dcp; the last one ends at data
+    *dcp,
+    *rcl,     // literal chunks as (start, end) pairs, up to rcp
+    *rcp,
+    *drl,     // code words holding a data address, in the order emitted, up to drp (drx: end of the area)
+    *drp,
+    *drx,
+    rsz,      // bytes in the current literal chunk
+    *ltab,    // open-addressing index of the literals by contents
+    lmask,    // ltab size - 1 (a power of two)
+    nlit,     // literals in ltab
+    *ctab,    // lexer class of each character (indexed -128..255): 0 blank, 1 letter, 2 digit, 3 newline, 4 see next(), else its token
+    *lines,   // last code word emitted on each source line (-s, -P), numbered across all the files
+    lbase,    // lines of the files before the current one
+    *tu,      // source files as (text, name, lbase) triples, ntu of them
+    ntu,
     *id,      // currently parsed identifier
-    *sym,     // symbol table (simple list of identifiers)
+    *syme,    // next free symbol table entry (chunks of Idsz-stride entries)
+    *symx,    // end of the current symbol chunk
+    *htab,    // open-addressing index into the symbol table by Hash
+    hmask,    // htab size - 1 (a power of two)
+    nsym,     // symbols in htab
+    *us, *up, *ux, // undo stack of the symbols shadowed by the current function
     tk,       // current token
     ival,     // current token value
     ty,       // current expression type
+    *tj,      // end of the last function call expr() emitted, for return's tail calls
+    addr,     // the current function takes the address of a parameter or local, so no tail calls
     loc,      // local variable offset
+    *ent,     // operand of the current function's ENT, switch statements add their temporaries to it
+    swd,      // switch statements open around the current statement
+    nsw,      // switch temporaries of the current function
+    *brks,     // breaks of the innermost loop or switch, chained through their JMP operands
+    lpd,      // loops and switch statements open around the current statement
+    *cases,   // (value, address) pairs of the cases of the open switch statements, up to csp
+    *csp,
+    *csw,     // first case of the innermost switch
+    *csx,     // end of the case area
+    dfl,      // address of the innermost switch's default, 0 without one
     line,     // current line number
     src,      // print source and assembly flag
-    debug;    // print executed instructions
+    debug,    // 1: print executed instructions (-d), 2: profile them (-p), 3: sample them (-P)
+    tos,      // run on the stack-caching engine
+    jit,      // run as native code
+    zc,       // run on a compact 32-bit translation of the code
+    opt,      // -O: run optimize() after peep()
+    inl,      // -i: inline the leaf functions of up to inl code words
+    *ilog,    // -i: (symbol, call sites inlined) pairs for -s, up to ilp
+    *ilp,
+    oc,       // bytes the current printf has output
+    *gfl,     // guest heap: free list of each 16-byte size class up to 1 KiB
+    *gst,     // mallocs, frees, bytes asked for, live bytes, peak live bytes, arena bytes
+    keep,     // -k: guest free() keeps the memory
+    srv,      // -f: run once per line of stdin, forked from the compiled program
+    sq,       // -t: run once per line of stdin, the runs taking turns of sq cycles
+    clim,     // -c: cycles a -t run may take
+    poolsz,   // first chunk of each area, they grow on demand
+    *vs,      // VM stack area, vsz bytes
+    vsz,
+    tparse,   // --stats: microseconds spent loading and compiling
+    trun,     // --stats: when the run started
+    *popc,    // -p: executions of each opcode
+    *pfn,     // -p: calls, inclusive and exclusive cycles, active frames of the function at each code offset
+    *pst,     // -p: call stack of (code offset, entry cycle, cycles spent in callees), up to psp
+    *psp,
+    *idm;     // main's symbol
+
+int *gva,     // address of each global above, in the order a context holds them (options first, Nopt of them)
+    ngv,
+    *ctx;     // the context the globals above belong to now
 
 // tokens and classes (operators last and in precedence order)
 enum {
-  Num = 128, Fun, Sys, Glo, Loc, Id,
-  Char, Else, Enum, If, Int, Return, Sizeof, While,
+  Num = 128, Fun, Sys, Glo, Loc, Fwd, Id, // Fwd: a function called before its definition
+  Break, Case, Char, Default, Else, Enum, For, If, Int, Return, Sizeof, Switch, While,
   Assign, Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak
 };
 
-// opcodes
-enum { LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,
-       OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,
-       OPEN,READ,CLOS,PRTF,MALC,FREE,MSET,MCMP,EXIT };
+// opcodes (those up to ADJ take an operand, JMP..GEBZ take a code address; TJSR is followed by
+// the ADJ of the call, JTAB n by n + 1 JMPs: to the case of each value of a in 0..n-1, the default)
+enum { LEA ,IMM ,LLI ,LLC ,LGI ,LGC ,ADDI,SUBI,MULI,JMP ,JSR ,TJSR,BZ  ,BNZ ,EQBZ,NEBZ,LTBZ,GTBZ,LEBZ,GEBZ,NAT ,JTAB,ENT ,ADJ ,
+       LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,NOT ,
+       OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,EXIT };
+
+// library functions, called by NAT with their index (in the order of the names in main())
+enum { OPEN, READ, CLOS, PRTF, MALC, FREE, MSET, MCMP, MCPY, SLEN, WRIT, PUTC };
 
 // types
 enum { CHAR, INT, PTR };
@@ -45,44 +152,243 @@ enum { CHAR, INT, PTR };
 // identifier offsets (since we can't create an ident struct)
 enum { Tk, Hash, Name, Class, Type, Val, HClass, HType, HVal, Idsz };
 
+// VM context offsets: registers, cycles run, exit code, stack area, -t's copy of the data
+enum { VPc, VSp, VBp, VA, VCyc, VExit, VStk, VDat, Vsz };
+
+// the command line options lead a program context, see cnew()
+enum { Nopt = 13 };
+
+#if C4_THREADED
+#include "c4_threaded.h"
+#endif
+#if C4_JIT
+#include "c4_jit.h"
+#endif
+
+char *grow(char *a, int n, int m) // move the first n bytes of a into a fresh m byte area
+{
+  char *b, *c;
+
+  if (!(b = c = malloc(m))) { printf("could not malloc(%d) area\n", m); exit(-1); }
+  while (n-- > 0) *c++ = *a++;
+  return b;
+}
+
+int slurp(int fd) // read fd to its end into lp and p, returning the length
+{
+  char *o;
+  int n, i, a;
+
+  n = 16*1024;
+  if (!(lp = p = malloc(n))) { printf("could not malloc(%d) source area\n", n); exit(-1); }
+  i = 0;
+  while ((a = read(fd, p + i, n - 1 - i)) > 0) {
+    if ((i = i + a) == n - 1) { o = p; lp = p = grow(p, i, n * 2); free(o); n = n * 2; }
+  }
+  if (i <= 0) { printf("read() returned %d\n", a); exit(-1); }
+  p[i] = 0;
+  return i;
+}
+
+int imgv() // c4b image version: a hash of the opcode names, see unpack()
+{
+  char *s;
+  int h;
+
+  s = opn; h = 0; while (*s) h = h * 147 + *s++;
+  return h;
+}
+
+#if C4_HOST
+#include "c4_host.h"
+#else
+char *zalloc(int n) { char *m; if (m = malloc(n)) memset(m, 0, n); return m; } // zeroed area
+int load(int fd) { return slurp(fd); } // source into lp and p (writable), returning its length
+int save(char *f, int *pc) { printf("-o needs a C4_HOST build\n"); return -1; } // c4b image
+char *eol(char *s) { while (*s != 0 && *s != '\n') ++s; return s; } // end of the line at s
+int serve(int *x, int *pc, char *name) { printf("-f needs a C4_HOST build\n"); return -1; } // fork per request
+int usec() { return 0; } // clock in microseconds
+void ostdio(char *s, int n) { while (n-- > 0) putchar(*s++); } // n bytes at s to stdout, in order with printf
+void wstats(int c, int x) { printf("--stats needs a C4_HOST build\n"); } // JSON statistics
+#endif
+
+// c4b image, written by save(): a header of six words
+//   "c4b-img\n", version, text words n, data bytes m, main offset, relocation count
+// then text[0..n], the data, and one word per relocation: the text index
+// of an address times two, plus one for a data address.  Addresses are
+// stored as word offsets into text or byte offsets into the data.  The
+// version is imgv(), a hash of the opcode names, so an image from a c4
+// with other opcodes is refused rather than run.
+
+int *unpack(int n) // relocate the image loaded at p in place, returning main
+{
+  int *h, *r, *x, k, v;
+  char *d;
+
+  h = (int *)p;
+  if (n < 6 * sizeof(int)) { printf("bad c4b image\n"); return 0; }
+  if (h[1] != imgv()) { printf("c4b image from another version of c4, compile it again\n"); return 0; }
+  if (h[2] < 1 || h[3] < 0 || h[4] < 1 || h[4] > h[2] || h[5] < 0 ||
+      h[2] > n / sizeof(int) || h[3] > n || h[5] > n / sizeof(int) || (h[2] + 7 + h[5]) * sizeof(int) + h[3] > n) { printf("bad c4b image\n"); return 0; }
+  text = h + 6; e = text + h[2];
+  d = (char *)(e + 1);
+  r = (int *)(d + h[3]); x = r + h[5];
+  while (r < x) {
+    k = *r++;
+    if (k < 2 || k >> 1 > h[2] || (v = text[k >> 1]) < 0 || v >= ((k & 1) ? h[3] : h[2] + 1)) {
+      printf("bad c4b relocation %d\n", k); return 0;
+    }
+    if (k & 1) text[k >> 1] = (int)(d + v);
+    else text[k >> 1] = (int)(text + v);
+  }
+  return text + h[4];
+}
+
+void smore() // start a new chunk of symbol entries
+{
+  if (!(syme = (int *)zalloc(256 * Idsz * sizeof(int)))) { printf("could not malloc(%d) symbol area\n", 256 * Idsz * sizeof(int)); exit(-1); }
+  symx = syme + 256 * Idsz;
+}
+
+void rehash() // double htab once it is half full
+{
+  int *o, *s, n, h;
+
+  o = htab; n = hmask + 1; hmask = 2 * n - 1;
+  if (!(htab = (int *)zalloc(2 * n * sizeof(int)))) { printf("could not malloc(%d) hash area\n", 2 * n * sizeof(int)); exit(-1); }
+  while (n-- > 0) {
+    if (s = (int *)o[n]) {
+      h = (s[Hash] ^ s[Hash] >> 6) & hmask;
+      while (htab[h]) h = (h + 1) & hmask;
+      htab[h] = (int)s;
+    }
+  }
+  free(o);
+}
+
+void dmore() // start a new data chunk, carrying over the string literal being lexed
+{
+  char *s;
+  int n;
+
+  s = lit ? lit : data; n = data - s;
+  if (dcp > dcl) { dcp[-1] = (int)s; dsz = dsz * 2; } // chunks double, 64 is plenty
+  while (dsz < 4 * n) dsz = dsz * 2;
+  if (!(data = zalloc(dsz))) { printf("could not malloc(%d) data area\n", dsz); exit(-1); }
+  *dcp++ = (int)data; *dcp++ = 0;
+  dmax = data + dsz - 2 * sizeof(int); // a string still gets its terminator and alignment
+  if (lit) lit = data;
+  while (n-- > 0) *data++ = *s++;
+}
+
+// String literals are lexed into data like before, then expr() moves each
+// finished one to a literal area of its own, where equal literals are
+// stored once, and gives the data back.  Keeping them apart from the
+// globals lets save() put them on pages nothing writes to.
+
+int lhash(char *s, int n) // hash of the n bytes at s
+{
+  int h;
+
+  h = 0; while (n-- > 0) h = h * 147 + *s++;
+  return h ^ h >> 6;
+}
+
+void lgrow() // double ltab once it is half full
+{
+  int *o, n, h;
+  char *r;
+
+  o = ltab; n = lmask + 1; lmask = 2 * n - 1;
+  if (!(ltab = (int *)zalloc(2 * n * sizeof(int)))) { printf("could not malloc(%d) literal index\n", 2 * n * sizeof(int)); exit(-1); }
+  while (n-- > 0) {
+    if (r = (char *)o[n]) {
+      h = lhash(r, strlen(r)) & lmask;
+      while (ltab[h]) h = (h + 1) & lmask;
+      ltab[h] = (int)r;
+    }
+  }
+  free(o);
+}
+
+char *intern(char *s, int n) // the literal area copy of the n byte string at s, shared by equal literals
+{
+  int h, i;
+  char *r;
+
+  h = lhash(s, n) & lmask;
+  while (r = (char *)ltab[h]) {
+    i = 0; while (i <= n && r[i] == s[i]) ++i; // s[n] is its terminator
+    if (i > n) return r;
+    h = (h + 1) & lmask;
+  }
+  if (rp + n + 1 > rmax) {
+    if (rcp > rcl) rsz = rsz * 2; // chunks double, 64 is plenty
+    while (rsz < 2 * (n + 1)) rsz = rsz * 2;
+    if (!(rp = zalloc(rsz))) { printf("could not malloc(%d) literal area\n", rsz); exit(-1); }
+    *rcp++ = (int)rp; *rcp++ = (int)rp;
+    rmax = rp + rsz;
+  }
+  memcpy(rp, s, n);
+  r = rp; rp = rp + ((n + 8) & -8); rcp[-1] = (int)rp;
+  ltab[h] = (int)r;
+  if (++nlit * 2 > lmask) lgrow();
+  return r;
+}
+
+void tmore() // continue the code in a fresh text chunk, flat() joins them up after parsing
+{
+  *tcp++ = (int)tb; *tcp++ = (int)e;
+  tsz = tsz * 2; while (tsz < 64 * xd + 128) tsz = tsz * 2;
+  if (!(tb = e = malloc(tsz * sizeof(int)))) { printf("could not malloc(%d) text area\n", tsz * sizeof(int)); exit(-1); }
+  tmax = tb + tsz - 64; // what stmt() may emit between checks, see expr() for the rest
+}
+
+void dref() // the word at e holds a data address, save() relocates it
+{
+  int n;
+
+  if (drp == drx) { n = drx - drl; drp = (int *)grow((char *)drl, n * sizeof(int), 2 * n * sizeof(int)); free(drl); drl = drp; drp = drl + n; drx = drl + 2 * n; }
+  *drp++ = (int)e;
+}
+
+void dcut(int *m) // the code after e up to m was dropped, and the data addresses it held
+{
+  while (drp > drl && (int *)drp[-1] > e && (int *)drp[-1] <= m) --drp;
+}
+
 void next()
 {
   char *pp;
+  int h, c;
 
   while (tk = *p) {
     ++p;
-    if (tk == '\n') {
-      if (src) {
-        printf("%d: %.*s", line, p - lp, lp);
-        lp = p;
-        while (le < e) {
-          printf("%8.4s", &"LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,"
-                           "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
-                           "OPEN,READ,CLOS,PRTF,MALC,FREE,MSET,MCMP,EXIT,"[*++le * 5]);
-          if (*le <= ADJ) printf(" %d\n", *++le); else printf("\n");
-        }
-      }
+    if ((c = ctab[tk]) > 4) { tk = c; return; } // a token by itself
+    else if (!c) { while (!ctab[*p]) ++p; } // blanks, and characters c4 ignores
+    else if (c == 3) {
+      if (lines) lines[lbase + line] = (int)e; // listed by list() once the code is final
       ++line;
     }
-    else if (tk == '#') {
-      while (*p != 0 && *p != '\n') ++p;
-    }
-    else if ((tk >= 'a' && tk <= 'z') || (tk >= 'A' && tk <= 'Z') || tk == '_') {
+    else if (c == 1) {
       pp = p - 1;
-      while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_')
-        tk = tk * 147 + *p++;
+      while ((c = ctab[*p]) == 1 || c == 2) tk = tk * 147 + *p++;
       tk = (tk << 6) + (p - pp);
-      id = sym;
-      while (id[Tk]) {
+      h = (tk ^ tk >> 6) & hmask; // low bits of tk are the length, mix in the rest
+      while (id = (int *)htab[h]) {
         if (tk == id[Hash] && !memcmp((char *)id[Name], pp, p - pp)) { tk = id[Tk]; return; }
-        id = id + Idsz;
+        h = (h + 1) & hmask;
       }
+      if (syme >= symx) smore();
+      htab[h] = (int)(id = syme);
+      syme = syme + Idsz;
       id[Name] = (int)pp;
       id[Hash] = tk;
       tk = id[Tk] = Id;
+      if (++nsym * 2 > hmask) rehash();
       return;
     }
-    else if (tk >= '0' && tk <= '9') {
+    else if (c == 2) {
       if (ival = tk - '0') { while (*p >= '0' && *p <= '9') ival = ival * 10 + *p++ - '0'; }
       else if (*p == 'x' || *p == 'X') {
         while ((tk = *++p) && ((tk >= '0' && tk <= '9') || (tk >= 'a' && tk <= 'f') || (tk >= 'A' && tk <= 'F')))
@@ -92,26 +398,24 @@ void next()
       tk = Num;
       return;
     }
+    else if (tk == '#') p = eol(p);
     else if (tk == '/') {
-      if (*p == '/') {
-        ++p;
-        while (*p != 0 && *p != '\n') ++p;
-      }
+      if (*p == '/') p = eol(p + 1);
       else {
         tk = Div;
         return;
       }
     }
     else if (tk == '\'' || tk == '"') {
-      pp = data;
+      if (tk == '"' && !lit) lit = data; // adjacent literals concatenate, see expr()
       while (*p != 0 && *p != tk) {
         if ((ival = *p++) == '\\') {
           if ((ival = *p++) == 'n') ival = '\n';
         }
-        if (tk == '"') *data++ = ival;
+        if (tk == '"') { if (data >= dmax) dmore(); *data++ = ival; }
       }
       ++p;
-      if (tk == '"') ival = (int)pp; else tk = Num;
+      if (tk == '"') ival = (int)lit; else tk = Num;
       return;
     }
     else if (tk == '=') { if (*p == '=') { ++p; tk = Eq; } else tk = Assign; return; }
@@ -122,31 +426,70 @@ void next()
     else if (tk == '>') { if (*p == '=') { ++p; tk = Ge; } else if (*p == '>') { ++p; tk = Shr; } else tk = Gt; return; }
     else if (tk == '|') { if (*p == '|') { ++p; tk = Lor; } else tk = Or; return; }
     else if (tk == '&') { if (*p == '&') { ++p; tk = Lan; } else tk = And; return; }
-    else if (tk == '^') { tk = Xor; return; }
-    else if (tk == '%') { tk = Mod; return; }
-    else if (tk == '*') { tk = Mul; return; }
-    else if (tk == '[') { tk = Brak; return; }
-    else if (tk == '?') { tk = Cond; return; }
-    else if (tk == '~' || tk == ';' || tk == '{' || tk == '}' || tk == '(' || tk == ')' || tk == ']' || tk == ',' || tk == ':') return;
+  }
+}
+
+void binop(int *b, int *d, int o) // emit o for the operands at b + 1 and after the PSH at d, folding constants
+{
+  int c, x, y, l, r, *m;
+
+  m = e; c = e == d + 2 && d[1] == IMM; // the right operand is IMM y
+  y = c ? d[2] : 0;
+  r = 0; // data addresses among two IMMs, the newest dref() entries: 1 the left, 2 the right
+  if (c && drp > drl && (int *)drp[-1] == d + 2) r = 2;
+  if (c && drp - drl > r / 2 && (int *)drp[-1 - r / 2] == b + 2) r = r | 1;
+  if (c && d == b + 3 && b[1] == IMM && (!r || (o == ADD && r != 3) || (o == SUB && r == 1)) && // an address plus or less a number
+      !((o == DIV || o == MOD) && (!y || (y == -1 && b[2] == -0x7fffffffffffffff - 1))) && !((o == SHL || o == SHR) && (y < 0 || y > 63))) {
+    x = b[2];
+    if      (o == OR)  x = x | y;
+    else if (o == XOR) x = x ^ y;
+    else if (o == AND) x = x & y;
+    else if (o == EQ)  x = x == y;
+    else if (o == NE)  x = x != y;
+    else if (o == LT)  x = x < y;
+    else if (o == GT)  x = x > y;
+    else if (o == LE)  x = x <= y;
+    else if (o == GE)  x = x >= y;
+    else if (o == SHL) x = x << y;
+    else if (o == SHR) x = x >> y;
+    else if (o == ADD) x = x + y;
+    else if (o == SUB) x = x - y;
+    else if (o == MUL) x = x * y;
+    else if (o == DIV) x = x / y;
+    else               x = x % y;
+    b[2] = x; e = b + 2;
+    if (r == 2) { dcut(m); dref(); } // the sum sits where the number was
+  }
+  else if (c && ((y == 1 && (o == MUL || o == DIV)) ||
+                 (!y && (o == ADD || o == SUB || o == OR || o == XOR || o == SHL || o == SHR)))) e = d - 1; // x op identity
+  else *++e = o;
+  if (e < m) dcut(m);
+  if (lines && e < m) { // lines that ended inside the dropped code end here now
+    l = lbase + line - 1; while (l > 0 && (int *)lines[l] > e && (int *)lines[l] <= m) lines[l--] = (int)e;
   }
 }
 
 void expr(int lev)
 {
-  int t, *d;
+  int t, *d, *b;
 
-  if (!tk) { printf("%d: unexpected eof in expression\n", line); exit(-1); }
+  // checked on entry only, while nothing looks back at *e: the levels still
+  // open may each emit up to 32 more words before the next expr() starts
+  if (e + 32 * ++xd > tmax) tmore();
+  b = e; // the value of this expression starts at b + 1
+  if (!tk) { printf("%s:%d: unexpected eof in expression\n", fname, line); exit(-1); }
   else if (tk == Num) { *++e = IMM; *++e = ival; next(); ty = INT; }
   else if (tk == '"') {
     *++e = IMM; *++e = ival; next();
     while (tk == '"') next();
-    data = (char *)((int)data + sizeof(int) & -sizeof(int)); ty = PTR;
+    *e = (int)intern(lit, data - lit); dref(); // dmore() may have moved it
+    memset(lit, 0, data - lit); data = lit; lit = 0; ty = PTR;
   }
   else if (tk == Sizeof) {
-    next(); if (tk == '(') next(); else { printf("%d: open paren expected in sizeof\n", line); exit(-1); }
+    next(); if (tk == '(') next(); else { printf("%s:%d: open paren expected in sizeof\n", fname, line); exit(-1); }
     ty = INT; if (tk == Int) next(); else if (tk == Char) { next(); ty = CHAR; }
     while (tk == Mul) { next(); ty = ty + PTR; }
-    if (tk == ')') next(); else { printf("%d: close paren expected in sizeof\n", line); exit(-1); }
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected in sizeof\n", fname, line); exit(-1); }
     *++e = IMM; *++e = (ty == CHAR) ? sizeof(char) : sizeof(int);
     ty = INT;
   }
@@ -157,17 +500,28 @@ void expr(int lev)
       t = 0;
       while (tk != ')') { expr(Assign); *++e = PSH; ++t; if (tk == ',') next(); }
       next();
-      if (d[Class] == Sys) *++e = d[Val];
+      if (d[Class] == Sys) {
+        if (d[Val] == EXIT) *++e = EXIT;
+        else {
+          if (narg[d[Val]] != '0' ? t != narg[d[Val]] - '0' : !t) { printf("%s:%d: wrong number of arguments\n", fname, line); exit(-1); }
+          *++e = NAT; *++e = d[Val];
+        }
+      }
       else if (d[Class] == Fun) { *++e = JSR; *++e = d[Val]; }
-      else { printf("%d: bad function call\n", line); exit(-1); }
-      if (t) { *++e = ADJ; *++e = t; }
+      else if (!d[Class] || d[Class] == Fwd) { // chain the call sites through the operands until parse() sees the definition
+        d[Class] = Fwd; d[Type] = INT;
+        *++e = JSR; *++e = d[Val]; d[Val] = (int)e;
+      }
+      else { printf("%s:%d: bad function call\n", fname, line); exit(-1); }
+      if (t || d[Class] == Sys) { *++e = ADJ; *++e = t; } // native() and the JIT read the count after NAT
+      if (d[Class] != Sys) tj = e;
       ty = d[Type];
     }
     else if (d[Class] == Num) { *++e = IMM; *++e = d[Val]; ty = INT; }
     else {
       if (d[Class] == Loc) { *++e = LEA; *++e = loc - d[Val]; }
-      else if (d[Class] == Glo) { *++e = IMM; *++e = d[Val]; }
-      else { printf("%d: undefined variable\n", line); exit(-1); }
+      else if (d[Class] == Glo) { *++e = IMM; *++e = d[Val]; dref(); }
+      else { printf("%s:%d: undefined variable\n", fname, line); exit(-1); }
       *++e = ((ty = d[Type]) == CHAR) ? LC : LI;
     }
   }
@@ -176,92 +530,93 @@ void expr(int lev)
     if (tk == Int || tk == Char) {
       t = (tk == Int) ? INT : CHAR; next();
       while (tk == Mul) { next(); t = t + PTR; }
-      if (tk == ')') next(); else { printf("%d: bad cast\n", line); exit(-1); }
+      if (tk == ')') next(); else { printf("%s:%d: bad cast\n", fname, line); exit(-1); }
       expr(Inc);
       ty = t;
     }
     else {
       expr(Assign);
-      if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+      if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     }
   }
   else if (tk == Mul) {
     next(); expr(Inc);
-    if (ty > INT) ty = ty - PTR; else { printf("%d: bad dereference\n", line); exit(-1); }
+    if (ty > INT) ty = ty - PTR; else { printf("%s:%d: bad dereference\n", fname, line); exit(-1); }
     *++e = (ty == CHAR) ? LC : LI;
   }
   else if (tk == And) {
     next(); expr(Inc);
-    if (*e == LC || *e == LI) --e; else { printf("%d: bad address-of\n", line); exit(-1); }
+    if (*e == LC || *e == LI) --e; else { printf("%s:%d: bad address-of\n", fname, line); exit(-1); }
+    if (e[-1] == LEA) addr = 1; // it may still be in use when we return
     ty = ty + PTR;
   }
-  else if (tk == '!') { next(); expr(Inc); *++e = PSH; *++e = IMM; *++e = 0; *++e = EQ; ty = INT; }
-  else if (tk == '~') { next(); expr(Inc); *++e = PSH; *++e = IMM; *++e = -1; *++e = XOR; ty = INT; }
+  else if (tk == '!') { next(); expr(Inc); *++e = PSH; d = e; *++e = IMM; *++e = 0; binop(b, d, EQ); ty = INT; }
+  else if (tk == '~') { next(); expr(Inc); *++e = PSH; d = e; *++e = IMM; *++e = -1; binop(b, d, XOR); ty = INT; }
   else if (tk == Add) { next(); expr(Inc); ty = INT; }
   else if (tk == Sub) {
-    next(); *++e = IMM;
-    if (tk == Num) { *++e = -ival; next(); } else { *++e = -1; *++e = PSH; expr(Inc); *++e = MUL; }
+    next();
+    if (tk == Num) { *++e = IMM; *++e = -ival; next(); } else { expr(Inc); *++e = PSH; d = e; *++e = IMM; *++e = -1; binop(b, d, MUL); }
     ty = INT;
   }
   else if (tk == Inc || tk == Dec) {
     t = tk; next(); expr(Inc);
     if (*e == LC) { *e = PSH; *++e = LC; }
     else if (*e == LI) { *e = PSH; *++e = LI; }
-    else { printf("%d: bad lvalue in pre-increment\n", line); exit(-1); }
+    else { printf("%s:%d: bad lvalue in pre-increment\n", fname, line); exit(-1); }
     *++e = PSH;
     *++e = IMM; *++e = (ty > PTR) ? sizeof(int) : sizeof(char);
     *++e = (t == Inc) ? ADD : SUB;
     *++e = (ty == CHAR) ? SC : SI;
   }
-  else { printf("%d: bad expression\n", line); exit(-1); }
+  else { printf("%s:%d: bad expression\n", fname, line); exit(-1); }
 
   while (tk >= lev) { // "precedence climbing" or "Top Down Operator Precedence" method
     t = ty;
     if (tk == Assign) {
       next();
-      if (*e == LC || *e == LI) *e = PSH; else { printf("%d: bad lvalue in assignment\n", line); exit(-1); }
+      if (*e == LC || *e == LI) *e = PSH; else { printf("%s:%d: bad lvalue in assignment\n", fname, line); exit(-1); }
       expr(Assign); *++e = ((ty = t) == CHAR) ? SC : SI;
     }
     else if (tk == Cond) {
       next();
       *++e = BZ; d = ++e;
       expr(Assign);
-      if (tk == ':') next(); else { printf("%d: conditional missing colon\n", line); exit(-1); }
+      if (tk == ':') next(); else { printf("%s:%d: conditional missing colon\n", fname, line); exit(-1); }
       *d = (int)(e + 3); *++e = JMP; d = ++e;
       expr(Cond);
       *d = (int)(e + 1);
     }
     else if (tk == Lor) { next(); *++e = BNZ; d = ++e; expr(Lan); *d = (int)(e + 1); ty = INT; }
     else if (tk == Lan) { next(); *++e = BZ;  d = ++e; expr(Or);  *d = (int)(e + 1); ty = INT; }
-    else if (tk == Or)  { next(); *++e = PSH; expr(Xor); *++e = OR;  ty = INT; }
-    else if (tk == Xor) { next(); *++e = PSH; expr(And); *++e = XOR; ty = INT; }
-    else if (tk == And) { next(); *++e = PSH; expr(Eq);  *++e = AND; ty = INT; }
-    else if (tk == Eq)  { next(); *++e = PSH; expr(Lt);  *++e = EQ;  ty = INT; }
-    else if (tk == Ne)  { next(); *++e = PSH; expr(Lt);  *++e = NE;  ty = INT; }
-    else if (tk == Lt)  { next(); *++e = PSH; expr(Shl); *++e = LT;  ty = INT; }
-    else if (tk == Gt)  { next(); *++e = PSH; expr(Shl); *++e = GT;  ty = INT; }
-    else if (tk == Le)  { next(); *++e = PSH; expr(Shl); *++e = LE;  ty = INT; }
-    else if (tk == Ge)  { next(); *++e = PSH; expr(Shl); *++e = GE;  ty = INT; }
-    else if (tk == Shl) { next(); *++e = PSH; expr(Add); *++e = SHL; ty = INT; }
-    else if (tk == Shr) { next(); *++e = PSH; expr(Add); *++e = SHR; ty = INT; }
+    else if (tk == Or)  { next(); *++e = PSH; d = e; expr(Xor); binop(b, d, OR);  ty = INT; }
+    else if (tk == Xor) { next(); *++e = PSH; d = e; expr(And); binop(b, d, XOR); ty = INT; }
+    else if (tk == And) { next(); *++e = PSH; d = e; expr(Eq);  binop(b, d, AND); ty = INT; }
+    else if (tk == Eq)  { next(); *++e = PSH; d = e; expr(Lt);  binop(b, d, EQ);  ty = INT; }
+    else if (tk == Ne)  { next(); *++e = PSH; d = e; expr(Lt);  binop(b, d, NE);  ty = INT; }
+    else if (tk == Lt)  { next(); *++e = PSH; d = e; expr(Shl); binop(b, d, LT);  ty = INT; }
+    else if (tk == Gt)  { next(); *++e = PSH; d = e; expr(Shl); binop(b, d, GT);  ty = INT; }
+    else if (tk == Le)  { next(); *++e = PSH; d = e; expr(Shl); binop(b, d, LE);  ty = INT; }
+    else if (tk == Ge)  { next(); *++e = PSH; d = e; expr(Shl); binop(b, d, GE);  ty = INT; }
+    else if (tk == Shl) { next(); *++e = PSH; d = e; expr(Add); binop(b, d, SHL); ty = INT; }
+    else if (tk == Shr) { next(); *++e = PSH; d = e; expr(Add); binop(b, d, SHR); ty = INT; }
     else if (tk == Add) {
-      next(); *++e = PSH; expr(Mul);
-      if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = sizeof(int); *++e = MUL;  }
-      *++e = ADD;
+      next(); *++e = PSH; d = e; expr(Mul);
+      if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = sizeof(int); binop(d, e - 2, MUL); }
+      binop(b, d, ADD);
     }
     else if (tk == Sub) {
-      next(); *++e = PSH; expr(Mul);
-      if (t > PTR && t == ty) { *++e = SUB; *++e = PSH; *++e = IMM; *++e = sizeof(int); *++e = DIV; ty = INT; }
-      else if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = sizeof(int); *++e = MUL; *++e = SUB; }
-      else *++e = SUB;
-    }
-    else if (tk == Mul) { next(); *++e = PSH; expr(Inc); *++e = MUL; ty = INT; }
-    else if (tk == Div) { next(); *++e = PSH; expr(Inc); *++e = DIV; ty = INT; }
-    else if (tk == Mod) { next(); *++e = PSH; expr(Inc); *++e = MOD; ty = INT; }
+      next(); *++e = PSH; d = e; expr(Mul);
+      if (t > PTR && t == ty) { binop(b, d, SUB); *++e = PSH; *++e = IMM; *++e = sizeof(int); binop(b, e - 2, DIV); ty = INT; }
+      else if ((ty = t) > PTR) { *++e = PSH; *++e = IMM; *++e = sizeof(int); binop(d, e - 2, MUL); binop(b, d, SUB); }
+      else binop(b, d, SUB);
+    }
+    else if (tk == Mul) { next(); *++e = PSH; d = e; expr(Inc); binop(b, d, MUL); ty = INT; }
+    else if (tk == Div) { next(); *++e = PSH; d = e; expr(Inc); binop(b, d, DIV); ty = INT; }
+    else if (tk == Mod) { next(); *++e = PSH; d = e; expr(Inc); binop(b, d, MOD); ty = INT; }
     else if (tk == Inc || tk == Dec) {
       if (*e == LC) { *e = PSH; *++e = LC; }
       else if (*e == LI) { *e = PSH; *++e = LI; }
-      else { printf("%d: bad lvalue in post-increment\n", line); exit(-1); }
+      else { printf("%s:%d: bad lvalue in post-increment\n", fname, line); exit(-1); }
       *++e = PSH; *++e = IMM; *++e = (ty > PTR) ? sizeof(int) : sizeof(char);
       *++e = (tk == Inc) ? ADD : SUB;
       *++e = (ty == CHAR) ? SC : SI;
@@ -270,26 +625,78 @@ void expr(int lev)
       next();
     }
     else if (tk == Brak) {
-      next(); *++e = PSH; expr(Assign);
-      if (tk == ']') next(); else { printf("%d: close bracket expected\n", line); exit(-1); }
-      if (t > PTR) { *++e = PSH; *++e = IMM; *++e = sizeof(int); *++e = MUL;  }
-      else if (t < PTR) { printf("%d: pointer type expected\n", line); exit(-1); }
-      *++e = ADD;
+      next(); *++e = PSH; d = e; expr(Assign);
+      if (tk == ']') next(); else { printf("%s:%d: close bracket expected\n", fname, line); exit(-1); }
+      if (t > PTR) { *++e = PSH; *++e = IMM; *++e = sizeof(int); binop(d, e - 2, MUL); }
+      else if (t < PTR) { printf("%s:%d: pointer type expected\n", fname, line); exit(-1); }
+      binop(b, d, ADD);
       *++e = ((ty = t - PTR) == CHAR) ? LC : LI;
     }
-    else { printf("%d: compiler error tk=%d\n", line, tk); exit(-1); }
+    else { printf("%s:%d: compiler error tk=%d\n", fname, line, tk); exit(-1); }
+  }
+  --xd;
+}
+
+void bpatch(int *a) // point the breaks chained from a at the next instruction
+{
+  int *r;
+
+  while (a) { r = (int *)*a; *a = (int)(e + 1); a = r; }
+}
+
+void jdef() // jump to the innermost switch's default, or past the switch
+{
+  *++e = JMP;
+  if (dfl) *++e = dfl; else { *++e = (int)brks; brks = e; }
+}
+
+// A switch stores its value in a temporary local and jumps over the body to
+// the dispatch code, which is emitted once all the cases are known: a range
+// of values at least half of which are cases becomes a JTAB, up to three
+// cases are tested in turn, and anything else is split in the middle by a
+// compare, so a sparse switch costs O(log n) branches.
+
+void swdisp(int *c, int n, int t) // dispatch on local t to the n (value, address) pairs at c, sorted by value
+{
+  int *b, *x, k;
+
+  if (e > tmax) tmore();
+  if (n >= 4 && c[2 * n - 2] / 2 - *c / 2 < n && c[2 * n - 2] - *c < 2 * n) { // the halves cannot overflow
+    x = c + 2 * n; k = *c;
+    *++e = LLI; *++e = t;
+    if (k) { *++e = SUBI; *++e = k; }
+    *++e = JTAB; *++e = x[-2] - k + 1;
+    while (c < x) {
+      if (e > tmax) tmore(); // the chunks are joined up before anything runs
+      if (*c == k) { *++e = JMP; *++e = c[1]; c = c + 2; } else jdef();
+      ++k;
+    }
+    jdef();
+  }
+  else if (n <= 3) {
+    while (n--) { *++e = LLI; *++e = t; *++e = PSH; *++e = IMM; *++e = *c; *++e = NEBZ; *++e = c[1]; c = c + 2; }
+    jdef();
+  }
+  else {
+    k = n / 2;
+    *++e = LLI; *++e = t; *++e = PSH; *++e = IMM; *++e = c[2 * k]; *++e = LTBZ; b = ++e;
+    swdisp(c, k, t);
+    *b = (int)(e + 1);
+    swdisp(c + 2 * k, n - k, t);
   }
 }
 
 void stmt()
 {
-  int *a, *b;
+  int *a, *b, *c, *d, *o, l, m, n, t, v;
+  char *q, *r, *u, s;
 
+  if (e > tmax) tmore();
   if (tk == If) {
     next();
-    if (tk == '(') next(); else { printf("%d: open paren expected\n", line); exit(-1); }
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
     expr(Assign);
-    if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
     *++e = BZ; b = ++e;
     stmt();
     if (tk == Else) {
@@ -301,20 +708,154 @@ void stmt()
   }
   else if (tk == While) {
     next();
-    a = e + 1;
-    if (tk == '(') next(); else { printf("%d: open paren expected\n", line); exit(-1); }
+    if (tk != '(') { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
+    c = brks; brks = 0; ++lpd;
+    q = p; l = line; n = 1; s = 0; // skip the condition, it is compiled below the body
+    while (n) {
+      next();
+      if (tk == '(') ++n; else if (tk == ')') --n;
+      else if (tk == '"') { s = 1; memset(lit, 0, data - lit); data = lit; lit = 0; }
+      else if (!tk) { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+    }
+    if (s) { // string literals are only lexed once, keep the test on top
+      p = q; line = l; next();
+      a = e + 1;
+      expr(Assign);
+      if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+      *++e = BZ; b = ++e;
+      stmt();
+      if (e > tmax) tmore();
+      *++e = JMP; *++e = (int)a;
+      *b = (int)(e + 1);
+    }
+    else { // JMP to the test, which branches back while it holds: one jump per iteration less
+      next();
+      *++e = JMP; b = ++e;
+      a = e + 1;
+      stmt();
+      *b = (int)(e + 1);
+      r = p; t = tk; v = ival; d = id; m = line; o = lines; // lexed past the body already
+      p = q; line = l; lines = 0; next();
+      expr(Assign);
+      if (tk != ')') { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+      *++e = BNZ; *++e = (int)a;
+      p = r; tk = t; ival = v; id = d; line = m; lines = o;
+    }
+    bpatch(brks); brks = c; --lpd;
+  }
+  else if (tk == For) {
+    next();
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
+    if (tk != ';') expr(Assign);
+    if (tk != ';') { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
+    c = brks; brks = 0; ++lpd;
+    q = p; l = line; u = 0; n = 1; s = 0; // skip the condition and the step, as in while
+    while (n) {
+      next();
+      if (tk == '(') ++n; else if (tk == ')') --n;
+      else if (tk == ';' && n == 1 && !u) { u = p; m = line; } // the step starts here
+      else if (tk == '"') { s = 1; memset(lit, 0, data - lit); data = lit; lit = 0; }
+      else if (!tk) { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+    }
+    if (!u) { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
+    if (s) { // in source order: test, JMP to the body, step, JMP to the test, body, JMP to the step
+      p = q; line = l; next();
+      a = e + 1; b = 0;
+      if (tk != ';') { expr(Assign); *++e = BZ; b = ++e; }
+      next();
+      *++e = JMP; d = ++e;
+      o = e + 1;
+      if (tk != ')') expr(Assign);
+      if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+      *++e = JMP; *++e = (int)a;
+      *d = (int)(e + 1);
+      stmt();
+      if (e > tmax) tmore();
+      *++e = JMP; *++e = (int)o;
+      if (b) *b = (int)(e + 1);
+    }
+    else { // body, step, then the test branching back: one branch per iteration
+      next();
+      *++e = JMP; b = ++e;
+      a = e + 1;
+      stmt();
+      r = p; t = tk; v = ival; d = id; n = line; o = lines; // lexed past the body already
+      p = u; line = m; lines = 0; next();
+      if (tk != ')') expr(Assign);
+      if (tk != ')') { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+      *b = (int)(e + 1);
+      p = q; line = l; next();
+      if (tk == ';') { *++e = JMP; *++e = (int)a; } // for (;;)
+      else {
+        expr(Assign);
+        if (tk != ';') { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
+        *++e = BNZ; *++e = (int)a;
+      }
+      p = r; tk = t; ival = v; id = d; line = n; lines = o;
+    }
+    bpatch(brks); brks = c; --lpd;
+  }
+  else if (tk == Switch) {
+    next();
+    if (tk == '(') next(); else { printf("%s:%d: open paren expected\n", fname, line); exit(-1); }
+    if (++swd > nsw) { ++nsw; ++*ent; } // one temporary per nesting level, below the locals
+    t = nsw - *ent - swd;
+    *++e = LEA; *++e = t; *++e = PSH;
     expr(Assign);
-    if (tk == ')') next(); else { printf("%d: close paren expected\n", line); exit(-1); }
-    *++e = BZ; b = ++e;
+    *++e = SI;
+    if (tk == ')') next(); else { printf("%s:%d: close paren expected\n", fname, line); exit(-1); }
+    *++e = JMP; b = ++e;
+    c = brks; brks = 0; ++lpd; a = csw; csw = csp; n = dfl; dfl = 0;
     stmt();
-    *++e = JMP; *++e = (int)a;
+    if (e > tmax) tmore();
+    *++e = JMP; *++e = (int)brks; brks = e; // the end of the body leaves the switch
     *b = (int)(e + 1);
+    d = csw + 2; // sort the cases by value
+    while (d < csp) {
+      v = *d; l = d[1]; o = d;
+      while (o > csw && o[-2] > v) { *o = o[-2]; o[1] = o[-1]; o = o - 2; }
+      *o = v; o[1] = l;
+      d = d + 2;
+    }
+    swdisp(csw, (csp - csw) / 2, t);
+    bpatch(brks);
+    csp = csw; csw = a; dfl = n; brks = c; --lpd; --swd;
+  }
+  else if (tk == Case) {
+    next();
+    if (!csw) { printf("%s:%d: case outside of switch\n", fname, line); exit(-1); }
+    b = e;
+    expr(Cond);
+    if (e[-1] != IMM || (e - 2 != b && e - 2 != tb)) { printf("%s:%d: case needs a constant\n", fname, line); exit(-1); }
+    v = *e; e = e - 2; dcut(e + 2);
+    if (tk == ':') next(); else { printf("%s:%d: colon expected\n", fname, line); exit(-1); }
+    d = csw; while (d < csp) { if (*d == v) { printf("%s:%d: duplicate case %d\n", fname, line, v); exit(-1); } d = d + 2; }
+    if (csp >= csx) { printf("%s:%d: too many cases\n", fname, line); exit(-1); }
+    *csp++ = v; *csp++ = (int)(e + 1);
+  }
+  else if (tk == Default) {
+    next();
+    if (!csw || dfl) { printf("%s:%d: bad default\n", fname, line); exit(-1); }
+    if (tk == ':') next(); else { printf("%s:%d: colon expected\n", fname, line); exit(-1); }
+    dfl = (int)(e + 1);
+  }
+  else if (tk == Break) {
+    next();
+    if (!lpd) { printf("%s:%d: break outside of loop or switch\n", fname, line); exit(-1); }
+    *++e = JMP; *++e = (int)brks; brks = e;
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
   else if (tk == Return) {
     next();
-    if (tk != ';') expr(Assign);
+    if (tk != ';') {
+      expr(Assign);
+      if (e == tj && !addr) { // a tail call: TJSR moves the arguments over ours and jumps
+        if (e[-1] != ADJ) { e[-1] = TJSR; *++e = ADJ; *++e = 0; }
+        else if (*e < loc) e[-3] = TJSR; // the caller of ours pops no more than we took
+      }
+    }
     *++e = LEV;
-    if (tk == ';') next(); else { printf("%d: semicolon expected\n", line); exit(-1); }
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
   else if (tk == '{') {
     next();
@@ -326,46 +867,666 @@ void stmt()
   }
   else {
     expr(Assign);
-    if (tk == ';') next(); else { printf("%d: semicolon expected\n", line); exit(-1); }
+    if (tk == ';') next(); else { printf("%s:%d: semicolon expected\n", fname, line); exit(-1); }
   }
 }
 
-int main(int argc, char **argv)
+int *reloc(int *a) // where the code address a in the text chunks lands in the joined text
 {
-  int fd, bt, ty, poolsz, *idmain;
-  int *pc, *sp, *bp, a, cycle; // vm registers
-  int i, *t; // temps
+  int *c, o;
 
-  --argc; ++argv;
-  if (argc > 0 && **argv == '-' && (*argv)[1] == 's') { src = 1; --argc; ++argv; }
-  if (argc > 0 && **argv == '-' && (*argv)[1] == 'd') { debug = 1; --argc; ++argv; }
-  if (argc < 1) { printf("usage: c4 [-s] [-d] file ...\n"); return -1; }
-
-  if ((fd = open(*argv, 0)) < 0) { printf("could not open(%s)\n", *argv); return -1; }
-
-  poolsz = 256*1024; // arbitrary size
-  if (!(sym = malloc(poolsz))) { printf("could not malloc(%d) symbol area\n", poolsz); return -1; }
-  if (!(le = e = malloc(poolsz))) { printf("could not malloc(%d) text area\n", poolsz); return -1; }
-  if (!(data = malloc(poolsz))) { printf("could not malloc(%d) data area\n", poolsz); return -1; }
-  if (!(sp = malloc(poolsz))) { printf("could not malloc(%d) stack area\n", poolsz); return -1; }
-
-  memset(sym,  0, poolsz);
-  memset(e,    0, poolsz);
-  memset(data, 0, poolsz);
-
-  p = "char else enum if int return sizeof while "
-      "open read close printf malloc free memset memcmp exit void main";
-  i = Char; while (i <= While) { next(); id[Tk] = i++; } // add keywords to symbol table
-  i = OPEN; while (i <= EXIT) { next(); id[Class] = Sys; id[Type] = INT; id[Val] = i++; } // add library to symbol table
-  next(); id[Tk] = Char; // handle void type
-  next(); idmain = id; // keep track of main
+  c = tcl; o = 0;
+  while (c < tcp) {
+    if (a > (int *)c[0] && a <= (int *)c[1] + 1) return text + o + (a - (int *)c[0]);
+    o = o + ((int *)c[1] - (int *)c[0]);
+    c = c + 2;
+  }
+  printf("bad code address %d\n", (int)a); exit(-1);
+}
 
-  if (!(lp = p = malloc(poolsz))) { printf("could not malloc(%d) source area\n", poolsz); return -1; }
-  if ((i = read(fd, p, poolsz-1)) <= 0) { printf("read() returned %d\n", i); return -1; }
-  p[i] = 0;
-  close(fd);
+void dmark(int j) // set dtag from the words dref() recorded, relocated into the joined text if j
+{
+  int *r;
+
+  if (!(dtag = zalloc(e - text + 2))) { printf("could not malloc(%d) relocation area\n", e - text + 2); exit(-1); }
+  r = drl;
+  while (r < drp) { dtag[(j ? reloc((int *)*r) : (int *)*r) - text] = 1; ++r; }
+}
+
+void flat() // join the text chunks into one area and relocate the code addresses
+{
+  int *c, *r, *s, i;
+
+  *tcp++ = (int)tb; *tcp++ = (int)e;
+  if (tcp == tcl + 2) { dmark(0); return; } // still in the first chunk
+  i = 0; c = tcl;
+  while (c < tcp) { i = i + ((int *)c[1] - (int *)c[0]); c = c + 2; }
+  if (!(text = r = malloc((i + 2) * sizeof(int)))) { printf("could not malloc(%d) text area\n", (i + 2) * sizeof(int)); exit(-1); }
+  c = tcl;
+  while (c < tcp) { s = (int *)c[0]; while (s < (int *)c[1]) *++r = *++s; c = c + 2; }
+  e = r;
+
+  r = text;
+  while (r < e) {
+    i = *++r;
+    if (i >= JMP && i <= GEBZ) r[1] = (int)reloc((int *)r[1]);
+    if (i <= ADJ) ++r;
+  }
+  dmark(1);
+  i = 0;
+  while (i <= hmask) {
+    if ((id = (int *)htab[i]) && id[Class] == Fun) id[Val] = (int)reloc((int *)id[Val]);
+    ++i;
+  }
+  if (lines) { i = 1; while (i < line) { lines[i] = (int)(reloc((int *)lines[i] + 1) - 1); ++i; } }
+  c = tcl;
+  while (c < tcp) { free((int *)c[0]); c = c + 2; }
+}
+
+void remap(int *nw, int *w) // the code was compacted to end before w, relocate through nw (old -> new offsets)
+{
+  int *r, i;
+
+  r = text; e = w - 1; // relocate branch targets, functions and the listing
+  while (r < e) {
+    i = *++r;
+    if (i >= JMP && i <= GEBZ) r[1] = (int)(text + nw[(int *)r[1] - text]);
+    if (i <= ADJ) ++r;
+  }
+  i = 0;
+  while (i <= hmask) {
+    if ((id = (int *)htab[i]) && id[Class] == Fun) id[Val] = (int)(text + nw[(int *)id[Val] - text]);
+    ++i;
+  }
+  if (lines) { i = 1; while (i < line) { lines[i] = (int)(text + nw[(int *)lines[i] + 1 - text] - 1); ++i; } }
+}
+
+void peep() // fuse the sequences expr() emits most into superinstructions
+{
+  int *tg, *nw, *r, *w, *d, *q, i, o, v, n;
+
+  n = (e - text + 2) * sizeof(int);
+  tg = (int *)zalloc(n); nw = malloc(n); // jump targets, old -> new code offsets
+  r = text;
+  while (r < e) {
+    i = *++r;
+    if (i >= JMP && i <= GEBZ) tg[(int *)r[1] - text] = 1;
+    if (i == JSR) tg[r + 2 - text] = 1; // return address
+    if (i <= ADJ) ++r;
+  }
+
+  r = w = text + 1; // compact in place, fused code never gets longer
+  while (r <= e) {
+    i = *r; o = 0; v = r[1]; q = r + 1; // q: the word v comes from, for its dtag
+    if ((i == LEA || i == IMM) && (r[2] == LI || r[2] == LC) && !tg[r + 2 - text]) {
+      o = (i == LEA) ? LLI : LGI; if (r[2] == LC) ++o; n = 3;
+    }
+    else if (i == PSH && r[1] == IMM && !tg[r + 1 - text] && !tg[r + 3 - text]) {
+      v = r[2]; q = r + 2; n = 4;
+      if      (r[3] == ADD) o = ADDI;
+      else if (r[3] == SUB) o = SUBI;
+      else if (r[3] == MUL) o = MULI;
+      else if (r[3] == EQ && !v) o = NOT;
+    }
+    else if (i >= EQ && i <= GE && r[1] == BZ && !tg[r + 1 - text]) { o = EQBZ + i - EQ; v = r[2]; n = 3; }
+    else if (i >= EQ && i <= GE && r[1] == BNZ && !tg[r + 1 - text] && (int *)r[2] <= r) {
+      // a backward BNZ is the test of a while loop, nothing reads a after it: branch unless the inverse holds
+      o = EQBZ + ((i - EQ < 2) ? 1 - (i - EQ) : 7 - (i - EQ)); v = r[2]; n = 3;
+    }
+    nw[r - text] = w - text;
+    if (o) { *w++ = o; if (o <= ADJ) { dtag[w - text] = dtag[q - text]; *w++ = v; } i = 1; while (i < n) nw[r + i++ - text] = w - text; }
+    else { *w++ = i; if (i <= ADJ) { nw[r + 1 - text] = w - text; dtag[w - text] = dtag[q - text]; *w++ = v; } n = (i <= ADJ) ? 2 : 1; }
+    r = r + n;
+  }
+  nw[r - text] = w - text;
+  remap(nw, w);
+
+  r = text; // thread branches through the jumps they land on
+  while (r < e) {
+    i = *++r;
+    if (i >= JMP && i <= GEBZ && i != JSR && i != TJSR) {
+      d = (int *)r[1]; n = 0;
+      while (n++ < 16) { // bounded, while (1); jumps to itself
+        if (*d == JMP) d = (int *)d[1];
+        else if (*d == BZ && i != JMP) d = (i == BNZ) ? d + 2 : (int *)d[1]; // a is 0 when i branches, unless BNZ
+        else if (*d == BNZ && i != JMP) d = (i == BNZ) ? (int *)d[1] : d + 2;
+        else n = 16;
+      }
+      r[1] = (int)d;
+    }
+    if (i <= ADJ) ++r;
+  }
+  free(tg); free(nw);
+}
+
+// -O runs one more pass over the fused code, a basic block at a time (the
+// blocks start at branch targets, return addresses and functions).  It
+// tracks what a is known to hold: a local's value or address, or a
+// constant, and which local the addresses pushed on the stack point to, so
+// that a store through them tells which local now equals a.  Loads of what
+// a already holds are dropped, and so is the code after a JMP or LEV that
+// nothing branches to.  Locals stay in the frame, which is what the VM
+// keeps its bp-relative "registers" in anyway.
+
+void optimize() // -O: drop the loads a already holds and unreachable code
+{
+  int *tg, *nw, *ms, *r, *w, i, v, n, k, x, d, m;
+
+  n = (e - text + 2) * sizeof(int);
+  tg = (int *)zalloc(n); nw = malloc(n); // block starts, old -> new code offsets
+  if (!tg || !nw || !(ms = malloc(64 * sizeof(int)))) { printf("could not malloc(%d) optimizer area\n", n); exit(-1); }
+  r = text;
+  while (r < e) {
+    i = *++r;
+    if (i >= JMP && i <= GEBZ) tg[(int *)r[1] - text] = 1;
+    if (i == JSR) tg[r + 2 - text] = 1;
+    if (i == JTAB) { v = 0; while (v <= r[1]) tg[r + 2 + 2 * v++ - text] = 1; } // its JMPs
+    if (i <= ADJ) ++r;
+  }
+  i = 0;
+  while (i <= hmask) { if ((id = (int *)htab[i]) && id[Class] == Fun) tg[(int *)id[Val] - text] = 1; ++i; }
+
+  r = w = text + 1; k = 0; x = 0; d = 0; m = 0; // a holds k (1 local, 2 constant, 3 local char, 4 local address) x; d words on the model stack ms; m: dead code
+  while (r <= e) {
+    i = *r; v = r[1]; n = (i <= ADJ) ? 2 : 1;
+    if (tg[r - text]) { k = 0; d = 0; m = 0; }
+    if (m || (k && x == v && ((i == LLI && k == 1) || (i == IMM && k == 2) || (i == LLC && k == 3) || (i == LEA && k == 4)))) {
+      nw[r - text] = w - text; if (n == 2) nw[r + 1 - text] = w - text;
+    }
+    else {
+      if      (i == LLI) { k = 1; x = v; }
+      else if (i == IMM) { k = 2; x = v; }
+      else if (i == LLC) { k = 3; x = v; }
+      else if (i == LEA) { k = 4; x = v; }
+      else if (i == PSH) { if (d < 64) ms[d] = (k == 4) ? x << 1 | 1 : 0; ++d; } // odd: the address of local x >> 1
+      else if (i == SI || i == SC) {
+        k = 0;
+        if (d > 0 && --d < 64 && ms[d]) { k = (i == SI) ? 1 : 3; x = ms[d] >> 1; }
+      }
+      else if (i == ADJ) { d = d - v; if (d < 0) d = 0; }
+      else if ((i >= OR && i <= MOD) || (i >= EQBZ && i <= GEBZ)) { if (d > 0) --d; k = 0; }
+      else if (i == ENT || i == LEV) { k = 0; d = 0; }
+      else if (i != JMP && i != BZ && i != BNZ) k = 0;
+      if (i == JMP || i == LEV) m = 1;
+      nw[r - text] = w - text; *w++ = i;
+      if (n == 2) { nw[r + 1 - text] = w - text; dtag[w - text] = dtag[r + 1 - text]; *w++ = v; }
+    }
+    r = r + n;
+  }
+  nw[r - text] = w - text;
+  remap(nw, w);
+  free(tg); free(nw); free(ms);
+}
+
+// -i<n> copies the functions of up to n code words that call nothing (so
+// none of them recurses) into their callers in place of the JSR.  The code
+// expr() and stmt() emit has a fixed stack depth at every point of a
+// function, so the copy keeps the frame JSR and ENT would have built at the
+// same place: the callee's bp is the caller's less its locals, the words
+// pushed before the JSR and the return address and saved bp.  LEA, LLI and
+// LLC offsets are rebased onto the caller's bp, so the address of a
+// parameter or local stays good; an ADJ reserves the callee's locals (none
+// for the usual accessor), and its LEVs jump past the copy to the caller's
+// ADJ, which pops the arguments as before.
+
+int fsize(int *f) // code words of the function at f if it calls nothing, else 0
+{
+  int *r;
+
+  r = f + 2;
+  while (r <= e && *r != ENT) { if (*r == JSR || *r == TJSR) return 0; r = r + ((*r <= ADJ) ? 2 : 1); }
+  return r - f;
+}
+
+void inline_all() // -i: substitute the small leaf functions at their call sites
+{
+  int *dp, *nw, *cm, *ib, *nt, *r, *w, *f, *g, *q, *x, *j, i, v, n, m, d, l, s, c, k;
+  char *nd;
+
+  n = e - text + 2;
+  dp = malloc(n * sizeof(int)); nw = malloc(n * sizeof(int)); cm = malloc(n * sizeof(int));
+  if (!dp || !nw || !cm || !(ilp = ilog = malloc(n * sizeof(int)))) { printf("could not malloc(%d) inliner area\n", 4 * n * sizeof(int)); exit(-1); }
+  i = 0; while (i < n) dp[i++] = -1;
+  k = 1; // words on the stack before each instruction, -1 in code nothing reaches
+  while (k) { // again while a backward branch reaches code first seen as unreached: the loop bodies after their JMP to the test
+    r = text + 1; d = -1; m = 0; k = 0;
+    while (r <= e) {
+      i = *r; v = r[1];
+      if (dp[r - text] >= 0) d = dp[r - text]; else dp[r - text] = d;
+      if (i == ENT) d = 0;
+      else if (d >= 0) {
+        if (i == PSH) ++d;
+        else if ((i >= OR && i <= MOD) || (i >= EQBZ && i <= GEBZ) || i == SI || i == SC) --d;
+        else if (i == ADJ) d = d - v;
+      }
+      if (i >= JMP && i <= GEBZ && i != JSR && i != TJSR && d >= 0 && dp[(int *)v - text] < 0) {
+        dp[(int *)v - text] = d; if ((int *)v <= r) k = 1;
+      }
+      if (i == JTAB) { s = 0; while (s <= v) dp[r + 2 + 2 * s++ - text] = d; }
+      if (i == JSR && (c = fsize((int *)v)) && c <= inl) m = m + 2 * c + 4;
+      if (i == JMP || i == LEV || i == TJSR) d = -1;
+      r = r + ((i <= ADJ) ? 2 : 1);
+    }
+  }
+  if (!m) { free(dp); free(nw); free(cm); return; }
+
+  if (!(nt = malloc((n + m) * sizeof(int))) || !(ib = (int *)zalloc((n + m) * sizeof(int))) || !(nd = zalloc(n + m))) {
+    printf("could not malloc(%d) text area\n", 2 * (n + m) * sizeof(int) + n + m); exit(-1);
+  }
+  r = text + 1; w = nt + 1; l = 0; // ib marks the branches of the copies, they already hold new offsets
+  while (r <= e) {
+    i = *r; v = r[1]; s = (i <= ADJ) ? 2 : 1;
+    nw[r - text] = w - nt; if (s == 2) nw[r + 1 - text] = w - nt + 1;
+    if (i == ENT) l = v;
+    f = (int *)v;
+    if (i == JSR && dp[r - text] >= 0 && (c = fsize(f)) && c <= inl) {
+      nw[r + 1 - text] = w - nt;
+      d = -l - dp[r - text] - 2; // callee bp - caller bp
+      if (f[1]) { *w++ = ADJ; *w++ = -2 - f[1]; }
+      x = f + c; g = f + 2; j = w;
+      while (g < x) { // where each word of the callee goes: a LEV becomes a jump to the end, or nothing at the end
+        cm[g - text] = j - nt;
+        if (*g == LEV) { q = g; while (q < x && *q == LEV) ++q; if (q < x) j = j + 2; }
+        else j = j + ((*g <= ADJ) ? 2 : 1);
+        g = g + ((*g <= ADJ) ? 2 : 1);
+      }
+      g = f + 2;
+      while (g < x) {
+        i = *g;
+        if (i == LEV) { q = g; while (q < x && *q == LEV) ++q; if (q < x) { *w++ = JMP; ib[w - nt] = 1; *w++ = j - nt; } }
+        else {
+          *w++ = i;
+          if (i <= ADJ) {
+            v = g[1];
+            if (i == LEA || i == LLI || i == LLC) v = v + d;
+            else if (i >= JMP && i <= GEBZ) { ib[w - nt] = 1; v = cm[(int *)v - text]; }
+            nd[w - nt] = dtag[g + 1 - text]; *w++ = v;
+          }
+        }
+        g = g + ((i <= ADJ) ? 2 : 1);
+      }
+      if (f[1]) { *w++ = ADJ; *w++ = 2 + f[1]; }
+      q = ilog; while (q < ilp && ((int *)*q)[Val] != (int)f) q = q + 2; // count it for -s
+      if (q == ilp) {
+        c = 0; while ((id = (int *)htab[c]) == 0 || id[Class] != Fun || id[Val] != (int)f) ++c;
+        *ilp++ = (int)id; *ilp++ = 0;
+      }
+      ++q[1];
+    }
+    else { *w++ = i; if (s == 2) { nd[w - nt] = dtag[r + 1 - text]; *w++ = v; } }
+    r = r + s;
+  }
+  nw[r - text] = w - nt;
+
+  r = nt; e = w - 1; // relocate branch targets, functions and the listing
+  while (r < e) {
+    i = *++r;
+    if (i >= JMP && i <= GEBZ) r[1] = (int)(nt + (ib[r + 1 - nt] ? r[1] : nw[(int *)r[1] - text]));
+    if (i <= ADJ) ++r;
+  }
+  i = 0;
+  while (i <= hmask) {
+    if ((id = (int *)htab[i]) && id[Class] == Fun) id[Val] = (int)(nt + nw[(int *)id[Val] - text]);
+    ++i;
+  }
+  if (lines) { i = 1; while (i < line) { lines[i] = (int)(nt + nw[(int *)lines[i] + 1 - text] - 1); ++i; } }
+  free(text); free(dp); free(nw); free(cm); free(ib); free(dtag);
+  text = nt; dtag = nd;
+}
+
+// Guest malloc() takes blocks up to 1 KiB from 1 MiB arena chunks in
+// 16-byte size classes, and recycles them through a free list per class.
+// Each block has a header word: its class, or for the larger blocks that go
+// straight to malloc() their size.
+
+char *gmalloc(int n) // guest malloc()
+{
+  int *b, c;
+
+  ++gst[0];
+  if (n < 0) return 0; // as malloc() would, a negative size is too big
+  gst[2] = gst[2] + n;
+  if (n > 1024) {
+    if (!(b = malloc(n + sizeof(int)))) return 0;
+    *b = c = n;
+  }
+  else {
+    if (!(c = (n + 15) >> 4)) c = 1;
+    if ((b = (int *)gfl[c])) gfl[c] = b[1];
+    else {
+      if (gp + (c << 4) + sizeof(int) > gx) {
+        if (!(gp = malloc(1024 * 1024))) { gx = 0; return 0; }
+        gx = gp + 1024 * 1024; gst[5] = gst[5] + 1024 * 1024;
+      }
+      b = (int *)gp; gp = gp + (c << 4) + sizeof(int);
+      *b = c;
+    }
+    c = c << 4;
+  }
+  if ((gst[3] = gst[3] + c) > gst[4]) gst[4] = gst[3];
+  return (char *)(b + 1);
+}
+
+void gfree(char *p) // guest free()
+{
+  int *b;
+
+  if (!p) return;
+  ++gst[1];
+  if (keep) return;
+  b = (int *)p - 1;
+  if (*b > 64) { gst[3] = gst[3] - *b; free(b); }
+  else { gst[3] = gst[3] - (*b << 4); b[1] = gfl[*b]; gfl[*b] = (int)b; }
+}
+
+void owrite(char *s, int n) // write n bytes at s to stdout
+{
+  int k;
+
+  while (n > 0 && (k = write(1, s, n)) > 0) { s = s + k; n = n - k; }
+}
+
+void oflush() // write out the guest output buffer
+{
+  if (debug == 1 || sq) ostdio(ob, obp - ob); // in line with the trace, or the other -t runs' exits
+  else owrite(ob, obp - ob);
+  obp = ob;
+}
+
+void oput(char *s, int n) // append n bytes at s to the output
+{
+  oc = oc + n;
+  if (obp + n > obx) {
+    oflush();
+    if (n > obx - ob) { owrite(s, n); return; }
+  }
+  memcpy(obp, s, n); obp = obp + n;
+}
+
+void opad(int c, int n) // append n copies of c
+{
+  int k;
+
+  while (n > 0) {
+    if (obp == obx) oflush();
+    k = obx - obp; if (k > n) k = n;
+    memset(obp, c, k); obp = obp + k; oc = oc + k; n = n - k;
+  }
+}
+
+int oprintf(char *f, int *a) // printf(f, a[0], a[-1], ..) into the output buffer
+{
+  char *s, *d;
+  int l, z, sg, alt, w, pr, v, n, b, k, neg, m;
+
+  oc = 0;
+  while (*f) {
+    s = f; // literal text straight into the buffer
+    while (*f && *f != '%') { if (obp == obx) oflush(); *obp++ = *f++; }
+    oc = oc + (f - s);
+    if (*f == '%') {
+      ++f; l = 0; z = 0; sg = 0; alt = 0; w = 0; pr = -1;
+      while (*f == '-' || *f == '0' || *f == '+' || *f == ' ' || *f == '#') {
+        if (*f == '-') l = 1; else if (*f == '0') z = 1; else if (*f == '+') sg = '+'; else if (*f == ' ') { if (!sg) sg = ' '; } else alt = 1;
+        ++f;
+      }
+      if (*f == '*') { w = *a--; ++f; if (w < 0) { l = 1; w = -w; } }
+      else while (*f >= '0' && *f <= '9') w = w * 10 + *f++ - '0';
+      if (*f == '.') {
+        ++f; pr = 0;
+        if (*f == '*') { pr = *a--; ++f; }
+        else while (*f >= '0' && *f <= '9') pr = pr * 10 + *f++ - '0';
+      }
+      while (*f == 'l' || *f == 'h' || *f == 'z' || *f == 'j' || *f == 't') ++f;
+      if (*f == 's' || (*f == 'p' && !*a)) {
+        if (*f == 'p') { s = "(nil)"; --a; pr = -1; }
+        else if (!(s = (char *)*a--)) s = "(null)";
+        n = 0; while (s[n] && (pr < 0 || n < pr)) ++n;
+        if (!l) opad(' ', w - n);
+        oput(s, n);
+        if (l) opad(' ', w - n);
+      }
+      else if (*f == 'c') {
+        d = obx; *d = *a--;
+        if (!l) opad(' ', w - 1);
+        oput(d, 1);
+        if (l) opad(' ', w - 1);
+      }
+      else if (*f == 'd' || *f == 'i' || *f == 'u' || *f == 'o' || *f == 'x' || *f == 'X' || *f == 'p') {
+        v = *a--; s = ""; neg = 0;
+        b = (*f == 'o') ? 8 : (*f == 'x' || *f == 'X' || *f == 'p') ? 16 : 10; k = (b == 8) ? 3 : 4;
+        if (*f == 'd' || *f == 'i') { if (v < 0) { neg = 1; s = "-"; } else if (sg == '+') s = "+"; else if (sg) s = " "; }
+        d = obx + 32; n = 0;
+        if (b == 10 && v < 0 && !neg) { m = (v >> 1) & 0x7fffffffffffffff; *--d = '0' + (m % 5) * 2 + (v & 1); v = m / 5; ++n; } // %u: v is 2m + its low bit
+        while (v) { // digits backwards, from a negative v too
+          if (b == 10) { *--d = '0' + (neg ? -(v % 10) : v % 10); v = v / 10; }
+          else { *--d = (*f == 'X' ? "0123456789ABCDEF" : "0123456789abcdef")[v & (b - 1)]; v = (v >> k) & (0x7fffffffffffffff >> (k - 1)); }
+          ++n;
+        }
+        if (pr < 0) pr = 1; else z = 0; // a precision is the least number of digits, and overrides 0
+        pr = pr - n;
+        if (alt && b == 8 && pr <= 0) pr = 1;
+        if ((alt && b == 16 && n) || *f == 'p') s = (*f == 'X') ? "0X" : "0x";
+        m = 0; while (s[m]) ++m;
+        if (pr > 0) m = m + pr;
+        if (!l && !z) opad(' ', w - m - n);
+        oput(s, (pr > 0) ? m - pr : m);
+        if (!l && z) opad('0', w - m - n);
+        opad('0', pr);
+        oput(d, n);
+        if (l) opad(' ', w - m - n);
+      }
+      else if (*f) oput(f, 1); // %% and anything unknown
+      if (*f) ++f;
+    }
+  }
+  return oc;
+}
+
+int native(int i, int *sp, int n) // library function i on the arguments at sp (printf: n of them)
+{
+  int *t;
+
+  if (i == OPEN) return open((char *)sp[1], *sp);
+  if (i == READ) { oflush(); return read(sp[2], (char *)sp[1], *sp); }
+  if (i == CLOS) return close(*sp);
+  if (i == PRTF) { t = sp + n; i = oprintf((char *)t[-1], t - 2); if (debug == 1) oflush(); return i; }
+  if (i == MALC) return (int)gmalloc(*sp);
+  if (i == FREE) { gfree((char *)*sp); return 0; }
+  if (i == MSET) return (int)memset((char *)sp[2], sp[1], *sp);
+  if (i == MCMP) return memcmp((char *)sp[2], (char *)sp[1], *sp);
+  if (i == MCPY) return (int)memcpy((char *)sp[2], (char *)sp[1], *sp);
+  if (i == SLEN) return strlen((char *)*sp);
+  if (i == WRIT) { oflush(); return write(sp[2], (char *)sp[1], *sp); }
+  if (i == PUTC) { if (obp == obx) oflush(); *obp++ = *sp; if (debug == 1) oflush(); return *sp & 255; }
+  printf("unknown library function = %d\n", i); exit(-1);
+}
+
+int idlen(char *m) // length of the identifier at m
+{
+  int n;
+
+  n = 0;
+  while ((m[n] >= 'a' && m[n] <= 'z') || (m[n] >= 'A' && m[n] <= 'Z') || (m[n] >= '0' && m[n] <= '9') || m[n] == '_') ++n;
+  return n;
+}
+
+void list() // print each source line followed by the code emitted for it
+{
+  int l, b, *f;
+  char *s;
+
+  l = 1; b = 0; le = text; f = tu;
+  while (l < line) {
+    while (f < tu + 3 * ntu && f[2] < l) { // the next file starts here
+      lp = (char *)f[0]; b = f[2];
+      if (ntu > 1) printf("%s:\n", (char *)f[1]);
+      f = f + 3;
+    }
+    s = lp; while (*s != '\n') ++s;
+    printf("%d: %.*s", l - b, ++s - lp, lp);
+    lp = s;
+    while (le < (int *)lines[l]) {
+      printf("%8.4s", &opn[*++le * 5]);
+      if (*le <= ADJ) printf(" %d\n", *++le); else printf("\n");
+    }
+    ++l;
+  }
+  f = ilog;
+  while (f < ilp) { // what -i inlined
+    printf("inlined %.*s() at %d call site%s\n", idlen((char *)((int *)*f)[Name]), (char *)((int *)*f)[Name], f[1], (f[1] == 1) ? "" : "s");
+    f = f + 2;
+  }
+}
+
+// -p keeps its counters in flat arrays: popc by opcode, and four words per
+// code offset in pfn for the functions JSR enters.  Exclusive cycles leave
+// out the callees; inclusive ones are only added when the outermost frame of
+// a function returns, so recursion is not counted twice.
+
+void pcall(int *f, int c) // -p: enter the function at f at cycle c
+{
+  int o;
+
+  o = 4 * (f - text);
+  ++pfn[o]; ++pfn[o + 3];
+  *psp++ = o; *psp++ = c; *psp++ = 0;
+}
+
+void pret(int c) // -p: leave the innermost function at cycle c
+{
+  int o, d;
+
+  if (psp == pst) return;
+  psp = psp - 3; o = *psp; d = c - psp[1];
+  pfn[o + 2] = pfn[o + 2] + d - psp[2];
+  if (!--pfn[o + 3]) pfn[o + 1] = pfn[o + 1] + d;
+  if (psp > pst) psp[-1] = psp[-1] + d;
+}
+
+void pstart(int *pc, int stksz) // -p: allocate the counters and enter main() at pc
+{
+  int n;
+
+  n = e - text + 1;
+  popc = (int *)zalloc((EXIT + 1) * sizeof(int));
+  pfn = (int *)zalloc(4 * n * sizeof(int));
+  psp = pst = malloc(3 * (stksz / 16 + 1) * sizeof(int)); // a frame is at least 2 stack words
+  if (!popc || !pfn || !pst) { printf("could not malloc(%d) profile area\n", 4 * n * sizeof(int)); exit(-1); }
+  pcall(pc, 0);
+}
+
+void psort(int *s, int n, int *key, int w) // order indices s[0..n) by key[s[i] * w], largest first
+{
+  int i, j, k, t;
+
+  i = 0;
+  while (i < n) {
+    k = i; j = i + 1;
+    while (j < n) { if (key[s[j] * w] > key[s[k] * w]) k = j; ++j; }
+    t = s[i]; s[i] = s[k]; s[k] = t;
+    ++i;
+  }
+}
+
+int pline(int *a) // source line of the code word at a in its file, 0 without a line table
+{
+  int l, h, m;
+
+  if (!lines) return 0;
+  l = 1; h = line - 1; // lines[] only grows, find the first line ending at or after a
+  while (l < h) { m = (l + h) / 2; if ((int *)lines[m] < a) l = m + 1; else h = m; }
+  m = ntu - 1; while (m > 0 && tu[3 * m + 2] >= l) --m;
+  return l - tu[3 * m + 2];
+}
+
+void pname(int *f) // print the name of the function at f, or its offset for images
+{
+  int i, *d;
+
+  i = 0;
+  while (i <= hmask) {
+    if ((d = (int *)htab[i]) && d[Class] == Fun && (int *)d[Val] == f) {
+      printf("%-20.*s", idlen((char *)d[Name]), (char *)d[Name]);
+      return;
+    }
+    ++i;
+  }
+  printf("@%-19d", f - text);
+}
+
+void preport(int c) // -p: close the frames still open at cycle c and print the profile
+{
+  int *s, i, k, n, v;
+
+  while (psp > pst) pret(c);
+  n = e - text + 1;
+  if (!(s = malloc((n + EXIT + 1) * sizeof(int)))) { printf("could not malloc(%d) profile area\n", (n + EXIT + 1) * sizeof(int)); exit(-1); }
+  if (!c) c = 1;
+
+  k = 0; i = 0;
+  while (i <= EXIT) { if (popc[i]) s[k++] = i; ++i; }
+  psort(s, k, popc, 1);
+  printf("%-8s %14s %7s\n", "opcode", "count", "%");
+  i = 0;
+  while (i < k) {
+    v = popc[s[i]] * 1000 / c;
+    printf("%-8.4s %14d %4d.%d\n", &opn[s[i] * 5], popc[s[i]], v / 10, v % 10);
+    ++i;
+  }
+
+  k = 0; i = 0;
+  while (i < n) { if (pfn[4 * i]) s[k++] = i; ++i; }
+  psort(s, k, pfn + 2, 4);
+  printf("%-20s %12s %14s %14s %7s\n", "function", "calls", "inclusive", "exclusive", "%");
+  i = 0;
+  while (i < k) {
+    v = pfn[4 * s[i] + 2] * 1000 / c;
+    pname(text + s[i]);
+    printf(" %12d %14d %14d %4d.%d\n", pfn[4 * s[i]], pfn[4 * s[i] + 1], pfn[4 * s[i] + 2], v / 10, v % 10);
+    ++i;
+  }
+  printf("heap: %d mallocs, %d frees, %d bytes asked for, %d live, %d peak, %d in arena chunks\n",
+    gst[0], gst[1], gst[2], gst[3], gst[4], gst[5]);
+  free(s);
+}
+
+void shadow(int t, int v) // declare id as a local of type t at v, keeping what it shadows
+{
+  int n, *o;
+
+  if (up == ux) {
+    n = ux - us; o = us;
+    us = (int *)grow((char *)us, n * sizeof(int), 2 * n * sizeof(int)); free(o);
+    up = us + n; ux = us + 2 * n;
+  }
+  *up++ = (int)id;
+  id[HClass] = id[Class]; id[Class] = Loc;
+  id[HType]  = id[Type];  id[Type] = t;
+  id[HVal]   = id[Val];   id[Val] = v;
+}
+
+int prefix(char *s, char *t) // s starts with t, reading no further than either ends (c4 has no strncmp)
+{
+  while (*t && *s == *t) { ++s; ++t; }
+  return !*t;
+}
+
+int streq(char *s, char *t) { return prefix(s, t) && prefix(t, s); } // c4 has no strcmp either
+
+int decimal(char *s)
+{
+  int v;
+
+  v = 0;
+  while (*s >= '0' && *s <= '9') v = v * 10 + *s++ - '0';
+  return v;
+}
+
+int parse() // the declarations of the program in p, 0 or -1 on errors
+{
+  int bt, ty, i, *a, *r;
 
-  // parse declarations
   line = 1;
   next();
   while (tk) {
@@ -379,11 +1540,11 @@ int main(int argc, char **argv)
         next();
         i = 0;
         while (tk != '}') {
-          if (tk != Id) { printf("%d: bad enum identifier %d\n", line, tk); return -1; }
+          if (tk != Id) { printf("%s:%d: bad enum identifier %d\n", fname, line, tk); return -1; }
           next();
           if (tk == Assign) {
             next();
-            if (tk != Num) { printf("%d: bad enum initializer\n", line); return -1; }
+            if (tk != Num) { printf("%s:%d: bad enum initializer\n", fname, line); return -1; }
             i = ival;
             next();
           }
@@ -396,29 +1557,29 @@ int main(int argc, char **argv)
     while (tk != ';' && tk != '}') {
       ty = bt;
       while (tk == Mul) { next(); ty = ty + PTR; }
-      if (tk != Id) { printf("%d: bad global declaration\n", line); return -1; }
-      if (id[Class]) { printf("%d: duplicate global definition\n", line); return -1; }
+      if (tk != Id) { printf("%s:%d: bad global declaration\n", fname, line); return -1; }
+      if (id[Class] && id[Class] != Fwd) { printf("%s:%d: duplicate global definition\n", fname, line); return -1; }
       next();
       id[Type] = ty;
       if (tk == '(') { // function
+        a = id[Class] == Fwd ? (int *)id[Val] : 0;
         id[Class] = Fun;
         id[Val] = (int)(e + 1);
+        while (a) { r = (int *)*a; *a = id[Val]; a = r; } // the calls that came before
         next(); i = 0;
         while (tk != ')') {
           ty = INT;
           if (tk == Int) next();
           else if (tk == Char) { next(); ty = CHAR; }
           while (tk == Mul) { next(); ty = ty + PTR; }
-          if (tk != Id) { printf("%d: bad parameter declaration\n", line); return -1; }
-          if (id[Class] == Loc) { printf("%d: duplicate parameter definition\n", line); return -1; }
-          id[HClass] = id[Class]; id[Class] = Loc;
-          id[HType]  = id[Type];  id[Type] = ty;
-          id[HVal]   = id[Val];   id[Val] = i++;
+          if (tk != Id) { printf("%s:%d: bad parameter declaration\n", fname, line); return -1; }
+          if (id[Class] == Loc) { printf("%s:%d: duplicate parameter definition\n", fname, line); return -1; }
+          shadow(ty, i++);
           next();
           if (tk == ',') next();
         }
         next();
-        if (tk != '{') { printf("%d: bad function definition\n", line); return -1; }
+        if (tk != '{') { printf("%s:%d: bad function definition\n", fname, line); return -1; }
         loc = ++i;
         next();
         while (tk == Int || tk == Char) {
@@ -427,30 +1588,28 @@ int main(int argc, char **argv)
           while (tk != ';') {
             ty = bt;
             while (tk == Mul) { next(); ty = ty + PTR; }
-            if (tk != Id) { printf("%d: bad local declaration\n", line); return -1; }
-            if (id[Class] == Loc) { printf("%d: duplicate local definition\n", line); return -1; }
-            id[HClass] = id[Class]; id[Class] = Loc;
-            id[HType]  = id[Type];  id[Type] = ty;
-            id[HVal]   = id[Val];   id[Val] = ++i;
+            if (tk != Id) { printf("%s:%d: bad local declaration\n", fname, line); return -1; }
+            if (id[Class] == Loc) { printf("%s:%d: duplicate local definition\n", fname, line); return -1; }
+            shadow(ty, ++i);
             next();
             if (tk == ',') next();
           }
           next();
         }
-        *++e = ENT; *++e = i - loc;
+        if (e > tmax) tmore();
+        *++e = ENT; ent = ++e; *e = i - loc; nsw = 0; addr = 0;
         while (tk != '}') stmt();
         *++e = LEV;
-        id = sym; // unwind symbol table locals
-        while (id[Tk]) {
-          if (id[Class] == Loc) {
-            id[Class] = id[HClass];
-            id[Type] = id[HType];
-            id[Val] = id[HVal];
-          }
-          id = id + Idsz;
+        while (up > us) { // unwind symbol table locals
+          id = (int *)*--up;
+          id[Class] = id[HClass];
+          id[Type] = id[HType];
+          id[Val] = id[HVal];
         }
       }
       else {
+        if (id[Class] == Fwd) { printf("%s:%d: duplicate global definition\n", fname, line); return -1; }
+        if (data >= dmax) dmore();
         id[Class] = Glo;
         id[Val] = (int)data;
         data = data + sizeof(int);
@@ -459,70 +1618,418 @@ int main(int argc, char **argv)
     }
     next();
   }
+  return 0;
+}
+
+// main() is the command line around the steps a host program can call
+// itself on a program context: cnew(), then compile() each source file and
+// build() the program (or unpack() an image), then run() it.  The sources
+// have to outlive their context, the symbol names point into them.  This is
+// not reentrant.  The compiler and the VM keep their state in the globals, and a
+// context is an int array with a word for each of them: compile(), build()
+// and run() swap the globals to the context they are given through use(),
+// and the other helpers work on the current one.  So a host can keep any
+// number of programs and compile and run them in any order, but only from
+// one thread.  A context runs once: the data keeps what the run left there
+// and the threaded engines rewrite the text.  test/run.sh checks that
+// gvars() lists every global.
+
+int *setup(int stksz) // allocate the compiler and runtime areas and enter the keywords, returning the main symbol
+{
+  int i;
+
+  poolsz = 16*1024;
+  vsz = stksz; // VM stack
+  if (!(vs = malloc(vsz))) { printf("could not malloc(%d) stack area\n", vsz); return 0; }
+  smore();
+  hmask = 1023;
+  if (!(htab = (int *)zalloc((hmask + 1) * sizeof(int)))) { printf("could not malloc(%d) hash area\n", (hmask + 1) * sizeof(int)); return 0; }
+  if (!(up = us = malloc(poolsz))) { printf("could not malloc(%d) undo area\n", poolsz); return 0; }
+  ux = us + poolsz / sizeof(int);
+  tsz = poolsz / sizeof(int);
+  if (!(text = le = e = tb = malloc(poolsz))) { printf("could not malloc(%d) text area\n", poolsz); return 0; }
+  tmax = tb + tsz - 64;
+  if (!(tcp = tcl = malloc(128 * sizeof(int)))) { printf("could not malloc(%d) text area\n", 128 * sizeof(int)); return 0; } // chunks double, 64 is plenty
+  if (!(dcp = dcl = malloc(128 * sizeof(int)))) { printf("could not malloc(%d) data area\n", 128 * sizeof(int)); return 0; }
+  dsz = poolsz; dmore();
+  if (!(csp = cases = malloc(poolsz))) { printf("could not malloc(%d) case area\n", poolsz); return 0; }
+  if (!(drp = drl = malloc(poolsz))) { printf("could not malloc(%d) relocation area\n", poolsz); return 0; }
+  drx = drl + poolsz / sizeof(int);
+  csx = cases + poolsz / sizeof(int);
+  if (!(rcp = rcl = malloc(128 * sizeof(int)))) { printf("could not malloc(%d) literal area\n", 128 * sizeof(int)); return 0; }
+  rsz = poolsz;
+  lmask = 255;
+  if (!(ltab = (int *)zalloc((lmask + 1) * sizeof(int)))) { printf("could not malloc(%d) literal index\n", (lmask + 1) * sizeof(int)); return 0; }
+  if (!(obp = ob = malloc(65536 + 32))) { printf("could not malloc(%d) output area\n", 65536 + 32); return 0; }
+  obx = ob + 65536;
+  if (!(gfl = (int *)zalloc(71 * sizeof(int)))) { printf("could not malloc(%d) heap area\n", 71 * sizeof(int)); return 0; }
+  gst = gfl + 65;
+  if (!(ctab = (int *)zalloc(384 * sizeof(int)))) { printf("could not malloc(%d) lexer table\n", 384 * sizeof(int)); return 0; }
+  ctab = ctab + 128; // signed or not, bytes from 0x80 up are blanks
+  i = 'a'; while (i <= 'z') { ctab[i] = ctab[i - 'a' + 'A'] = 1; ++i; }
+  ctab['_'] = 1;
+  i = '0'; while (i <= '9') ctab[i++] = 2;
+  ctab['\n'] = 3;
+  ctab[0] = 4; p = "#/'\"=+-!<>|&"; while (*p) ctab[*p++] = 4;
+  p = "~;{}()],:"; while (*p) { ctab[*p] = *p; ++p; }
+  ctab['^'] = Xor; ctab['%'] = Mod; ctab['*'] = Mul; ctab['['] = Brak; ctab['?'] = Cond;
 
-  if (!(pc = (int *)idmain[Val])) { printf("main() not defined\n"); return -1; }
-  if (src) return 0;
+  opn = "LEA ,IMM ,LLI ,LLC ,LGI ,LGC ,ADDI,SUBI,MULI,JMP ,JSR ,TJSR,BZ  ,BNZ ,EQBZ,NEBZ,LTBZ,GTBZ,LEBZ,GEBZ,NAT ,JTAB,ENT ,ADJ ,"
+        "LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,NOT ,"
+        "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,EXIT,";
+  narg = "231011333131";
+  p = "break case char default else enum for if int return sizeof switch while "
+      "open read close printf malloc free memset memcmp memcpy strlen write putchar exit void main";
+  i = Break; while (i <= While) { next(); id[Tk] = i++; } // add keywords to symbol table
+  i = OPEN; while (i <= PUTC) { next(); id[Class] = Sys; id[Type] = INT; id[Val] = i++; } // add library to symbol table
+  next(); id[Class] = Sys; id[Type] = INT; id[Val] = EXIT;
+  next(); id[Tk] = Char; // handle void type
+  next(); return id; // keep track of main
+}
+
+void gvars() // fill gva, the globals a context holds
+{
+  int *g;
+
+  if (!(g = gva = malloc(128 * sizeof(int)))) { printf("could not malloc(%d) context table\n", 128 * sizeof(int)); exit(-1); }
+  *g++ = (int)&src; *g++ = (int)&debug; *g++ = (int)&tos; *g++ = (int)&jit; *g++ = (int)&zc; *g++ = (int)&opt; *g++ = (int)&inl;
+  *g++ = (int)&keep; *g++ = (int)&srv; *g++ = (int)&sq; *g++ = (int)&clim; *g++ = (int)&fold; *g++ = (int)&stats; // the Nopt options
+  *g++ = (int)&p; *g++ = (int)&lp; *g++ = (int)&data; *g++ = (int)&dmax; *g++ = (int)&lit; *g++ = (int)&rp; *g++ = (int)&rmax;
+  *g++ = (int)&opn; *g++ = (int)&fname; *g++ = (int)&narg; *g++ = (int)&ob; *g++ = (int)&obp; *g++ = (int)&obx; *g++ = (int)&gp;
+  *g++ = (int)&gx; *g++ = (int)&dtag; *g++ = (int)&e; *g++ = (int)&le; *g++ = (int)&text; *g++ = (int)&tb; *g++ = (int)&tmax;
+  *g++ = (int)&xd; *g++ = (int)&tcl; *g++ = (int)&tcp; *g++ = (int)&tsz; *g++ = (int)&dsz; *g++ = (int)&dcl; *g++ = (int)&dcp;
+  *g++ = (int)&rcl; *g++ = (int)&rcp; *g++ = (int)&drl; *g++ = (int)&drp; *g++ = (int)&drx; *g++ = (int)&rsz; *g++ = (int)&ltab;
+  *g++ = (int)&lmask; *g++ = (int)&nlit; *g++ = (int)&ctab; *g++ = (int)&lines; *g++ = (int)&lbase; *g++ = (int)&tu; *g++ = (int)&ntu;
+  *g++ = (int)&id; *g++ = (int)&syme; *g++ = (int)&symx; *g++ = (int)&htab; *g++ = (int)&hmask; *g++ = (int)&nsym; *g++ = (int)&us;
+  *g++ = (int)&up; *g++ = (int)&ux; *g++ = (int)&tk; *g++ = (int)&ival; *g++ = (int)&ty; *g++ = (int)&tj; *g++ = (int)&addr;
+  *g++ = (int)&loc; *g++ = (int)&ent; *g++ = (int)&swd; *g++ = (int)&nsw; *g++ = (int)&brks; *g++ = (int)&lpd; *g++ = (int)&cases;
+  *g++ = (int)&csp; *g++ = (int)&csw; *g++ = (int)&csx; *g++ = (int)&dfl; *g++ = (int)&line; *g++ = (int)&ilog; *g++ = (int)&ilp;
+  *g++ = (int)&oc; *g++ = (int)&gfl; *g++ = (int)&gst; *g++ = (int)&poolsz; *g++ = (int)&vs; *g++ = (int)&vsz; *g++ = (int)&tparse;
+  *g++ = (int)&trun; *g++ = (int)&popc; *g++ = (int)&pfn; *g++ = (int)&pst; *g++ = (int)&psp; *g++ = (int)&idm;
+  ngv = g - gva;
+}
+
+void use(int *c) // make c the current context: save the globals to the one before, load c's
+{
+  int i;
+
+  if (c == ctx) return;
+  i = 0; if (ctx) while (i < ngv) { ctx[i] = *(int *)gva[i]; ++i; }
+  i = 0; while (i < ngv) { *(int *)gva[i] = c[i]; ++i; }
+  ctx = c;
+}
+
+int *cnew(int stksz) // a fresh program context with the current options and a stksz byte VM stack, made current; 0 on errors
+{
+  int *c, i;
+
+  if (!gva) gvars();
+  if (!(c = (int *)zalloc(ngv * sizeof(int)))) { printf("could not malloc(%d) context\n", ngv * sizeof(int)); return 0; }
+  i = 0; while (i < Nopt) { c[i] = *(int *)gva[i]; ++i; }
+  use(c);
+  if (!(idm = setup(stksz))) return 0;
+  return c;
+}
+
+int compile(int *c, char *s, int n, char *name) // parse the n bytes at s (then a NUL) of file name into c's program; -1 on errors
+{
+  int *t;
+
+  use(c);
+  if (s[n]) { printf("%s: source not followed by a NUL\n", name); return -1; }
+  if (src || debug == 3) { // a word for each line of the files so far, and at most n + 1 more
+    if (!(t = malloc((lbase + n + 2) * sizeof(int)))) { printf("could not malloc(%d) line area\n", (lbase + n + 2) * sizeof(int)); return -1; }
+    if (lines) { memcpy(t, lines, (lbase + 1) * sizeof(int)); free(lines); }
+    lines = t;
+  }
+  if (!(t = malloc(3 * (ntu + 1) * sizeof(int)))) { printf("could not malloc(%d) file area\n", 3 * (ntu + 1) * sizeof(int)); return -1; }
+  if (tu) { memcpy(t, tu, 3 * ntu * sizeof(int)); free(tu); }
+  tu = t; t = tu + 3 * ntu++;
+  t[0] = (int)s; t[1] = (int)name; t[2] = lbase;
+  p = lp = s; fname = name;
+  if (parse() < 0) return -1;
+  lbase = lbase + line - 1;
+  return 0;
+}
+
+int *build(int *c) // link the files compile() parsed in c into one program, returning main() or 0
+{
+  int i, *t;
+
+  use(c);
+  line = lbase + 1; lbase = 0; // from here on line counts the lines of all the files
+  i = 0;
+  while (i <= hmask) { // every function called has to be defined in one of them
+    if ((t = (int *)htab[i]) && t[Class] == Fwd) { printf("%.*s() not defined\n", idlen((char *)t[Name]), (char *)t[Name]); return 0; }
+    ++i;
+  }
+  flat();
+  peep();
+  if (inl) inline_all();
+  if (opt) optimize();
+  if (!idm[Val]) printf("main() not defined\n");
+  return (int *)idm[Val];
+}
+
+void vinit(int *c, int *pc, int *s, int stksz, int argc, char **argv) // context c calls the program at pc on the stksz byte stack at s
+{
+  int *sp, *t;
 
-  // setup stack
-  bp = sp = (int *)((int)sp + poolsz);
+  c[VBp] = (int)(sp = (int *)((int)s + stksz));
   *--sp = EXIT; // call exit if main returns
   *--sp = PSH; t = sp;
   *--sp = argc;
   *--sp = (int)argv;
   *--sp = (int)t;
+  c[VPc] = (int)pc; c[VSp] = (int)sp; c[VA] = 0; c[VCyc] = 0; c[VStk] = (int)s;
+}
 
-  // run...
-  cycle = 0;
-  while (1) {
+int vm(int *c, int n) // run context c for n more cycles (-1: to its end), returning 0 once it exited
+{
+  int *pc, *sp, *bp, a, cycle; // vm registers
+  int i; // temps
+
+  pc = (int *)c[VPc]; sp = (int *)c[VSp]; bp = (int *)c[VBp]; a = c[VA]; cycle = c[VCyc];
+  n = cycle + n; // never reached for -1
+  while (cycle != n) {
     i = *pc++; ++cycle;
     if (debug) {
-      printf("%d> %.4s", cycle,
-        &"LEA ,IMM ,JMP ,JSR ,BZ  ,BNZ ,ENT ,ADJ ,LEV ,LI  ,LC  ,SI  ,SC  ,PSH ,"
-         "OR  ,XOR ,AND ,EQ  ,NE  ,LT  ,GT  ,LE  ,GE  ,SHL ,SHR ,ADD ,SUB ,MUL ,DIV ,MOD ,"
-         "OPEN,READ,CLOS,PRTF,MALC,FREE,MSET,MCMP,EXIT,"[i * 5]);
-      if (i <= ADJ) printf(" %d\n", *pc); else printf("\n");
-    }
-    if      (i == LEA) a = (int)(bp + *pc++);                             // load local address
-    else if (i == IMM) a = *pc++;                                         // load global address or immediate
-    else if (i == JMP) pc = (int *)*pc;                                   // jump
-    else if (i == JSR) { *--sp = (int)(pc + 1); pc = (int *)*pc; }        // jump to subroutine
-    else if (i == BZ)  pc = a ? pc + 1 : (int *)*pc;                      // branch if zero
-    else if (i == BNZ) pc = a ? (int *)*pc : pc + 1;                      // branch if not zero
-    else if (i == ENT) { *--sp = (int)bp; bp = sp; sp = sp - *pc++; }     // enter subroutine
-    else if (i == ADJ) sp = sp + *pc++;                                   // stack adjust
-    else if (i == LEV) { sp = bp; bp = (int *)*sp++; pc = (int *)*sp++; } // leave subroutine
-    else if (i == LI)  a = *(int *)a;                                     // load int
-    else if (i == LC)  a = *(char *)a;                                    // load char
-    else if (i == SI)  *(int *)*sp++ = a;                                 // store int
-    else if (i == SC)  a = *(char *)*sp++ = a;                            // store char
-    else if (i == PSH) *--sp = a;                                         // push
-
-    else if (i == OR)  a = *sp++ |  a;
-    else if (i == XOR) a = *sp++ ^  a;
-    else if (i == AND) a = *sp++ &  a;
-    else if (i == EQ)  a = *sp++ == a;
-    else if (i == NE)  a = *sp++ != a;
-    else if (i == LT)  a = *sp++ <  a;
-    else if (i == GT)  a = *sp++ >  a;
-    else if (i == LE)  a = *sp++ <= a;
-    else if (i == GE)  a = *sp++ >= a;
-    else if (i == SHL) a = *sp++ << a;
-    else if (i == SHR) a = *sp++ >> a;
-    else if (i == ADD) a = *sp++ +  a;
-    else if (i == SUB) a = *sp++ -  a;
-    else if (i == MUL) a = *sp++ *  a;
-    else if (i == DIV) a = *sp++ /  a;
-    else if (i == MOD) a = *sp++ %  a;
-
-    else if (i == OPEN) a = open((char *)sp[1], *sp);
-    else if (i == READ) a = read(sp[2], (char *)sp[1], *sp);
-    else if (i == CLOS) a = close(*sp);
-    else if (i == PRTF) { t = sp + pc[1]; a = printf((char *)t[-1], t[-2], t[-3], t[-4], t[-5], t[-6]); }
-    else if (i == MALC) a = (int)malloc(*sp);
-    else if (i == FREE) free((void *)*sp);
-    else if (i == MSET) a = (int)memset((char *)sp[2], sp[1], *sp);
-    else if (i == MCMP) a = memcmp((char *)sp[2], (char *)sp[1], *sp);
-    else if (i == EXIT) { printf("exit(%d) cycle = %d\n", *sp, cycle); return *sp; }
-    else { printf("unknown instruction = %d! cycle = %d\n", i, cycle); return -1; }
+      if (debug == 2) {
+        ++popc[i];
+        if (i == JSR) pcall((int *)*pc, cycle);
+        else if (i == LEV) pret(cycle);
+        else if (i == TJSR) { pret(cycle); pcall((int *)*pc, cycle); }
+      }
+      else {
+        printf("%d> %.4s", cycle, &opn[i * 5]);
+        if (i <= ADJ) printf(" %d\n", *pc); else printf("\n");
+      }
+    }
+    switch (i) {
+      case LEA:  a = (int)(bp + *pc++); break;                                      // load local address
+      case IMM:  a = *pc++; break;                                                  // load global address or immediate
+      case LLI:  a = *(bp + *pc++); break;                                          // load local int
+      case LLC:  a = *(char *)(bp + *pc++); break;                                  // load local char
+      case LGI:  a = *(int *)*pc++; break;                                          // load global int
+      case LGC:  a = *(char *)*pc++; break;                                         // load global char
+      case ADDI: a = a + *pc++; break;                                              // add immediate
+      case SUBI: a = a - *pc++; break;                                              // subtract immediate
+      case MULI: a = a * *pc++; break;                                              // multiply immediate
+      case JMP:  pc = (int *)*pc; break;                                            // jump
+      case JSR:  *--sp = (int)(pc + 1); pc = (int *)*pc; break;                     // jump to subroutine
+      case TJSR: i = pc[2]; while (i) { --i; bp[2 + i] = sp[i]; }                   // tail call: the arguments over ours,
+                 sp = bp + 1; bp = (int *)*bp; pc = (int *)*pc; break;              // then as if our caller made the call
+      case BZ:   pc = a ? pc + 1 : (int *)*pc; break;                               // branch if zero
+      case BNZ:  pc = a ? (int *)*pc : pc + 1; break;                               // branch if not zero
+      case EQBZ: pc = (a = *sp++ == a) ? pc + 1 : (int *)*pc; break;                // compare and branch if false
+      case NEBZ: pc = (a = *sp++ != a) ? pc + 1 : (int *)*pc; break;
+      case LTBZ: pc = (a = *sp++ <  a) ? pc + 1 : (int *)*pc; break;
+      case GTBZ: pc = (a = *sp++ >  a) ? pc + 1 : (int *)*pc; break;
+      case LEBZ: pc = (a = *sp++ <= a) ? pc + 1 : (int *)*pc; break;
+      case GEBZ: pc = (a = *sp++ >= a) ? pc + 1 : (int *)*pc; break;
+      case ENT:  *--sp = (int)bp; bp = sp; sp = sp - *pc++; break;                  // enter subroutine
+      case ADJ:  sp = sp + *pc++; break;                                            // stack adjust
+      case LEV:  sp = bp; bp = (int *)*sp++; pc = (int *)*sp++; break;              // leave subroutine
+      case LI:   a = *(int *)a; break;                                              // load int
+      case LC:   a = *(char *)a; break;                                             // load char
+      case SI:   *(int *)*sp++ = a; break;                                          // store int
+      case SC:   a = *(char *)*sp++ = a; break;                                     // store char
+      case PSH:  *--sp = a; break;                                                  // push
+      case NOT:  a = !a; break;                                                     // logical not
+
+      case OR:   a = *sp++ |  a; break;
+      case XOR:  a = *sp++ ^  a; break;
+      case AND:  a = *sp++ &  a; break;
+      case EQ:   a = *sp++ == a; break;
+      case NE:   a = *sp++ != a; break;
+      case LT:   a = *sp++ <  a; break;
+      case GT:   a = *sp++ >  a; break;
+      case LE:   a = *sp++ <= a; break;
+      case GE:   a = *sp++ >= a; break;
+      case SHL:  a = *sp++ << a; break;
+      case SHR:  a = *sp++ >> a; break;
+      case ADD:  a = *sp++ +  a; break;
+      case SUB:  a = *sp++ -  a; break;
+      case MUL:  a = *sp++ *  a; break;
+      case DIV:  a = *sp++ /  a; break;
+      case MOD:  a = *sp++ %  a; break;
+
+      case NAT:  a = native(*pc, sp, pc[2]); ++pc; break;                           // call library function
+      case JTAB: pc = pc + 1 + 2 * ((a < 0 || a >= *pc) ? *pc : a); break;          // indexed jump through the JMPs after it
+      case EXIT:
+        oflush(); if (debug == 2) preport(cycle); if (stats) wstats(cycle, *sp);
+        printf("exit(%d) cycle = %d\n", *sp, cycle); c[VExit] = *sp; c[VCyc] = cycle; return 0;
+      default:   printf("unknown instruction = %d! cycle = %d\n", i, cycle); c[VExit] = -1; c[VCyc] = cycle; return 0;
+    }
+  }
+  c[VPc] = (int)pc; c[VSp] = (int)sp; c[VBp] = (int)bp; c[VA] = a; c[VCyc] = cycle;
+  return 1;
+}
+
+int run(int *x, int *pc, int argc, char **argv) // the program at pc in context x on its VM stack, returning its exit code
+{
+  int *sp, *bp, *t, *c;
+
+  use(x);
+  if (stats) memset(vs, 0xA5, vsz); // wstats() finds the deepest word written
+  if (!(c = malloc(Vsz * sizeof(int)))) { printf("could not malloc(%d) context\n", Vsz * sizeof(int)); return -1; }
+  vinit(c, pc, vs, vsz, argc, argv);
+  sp = (int *)c[VSp]; bp = (int *)c[VBp]; t = (int *)*sp; // t: the exit stub main() returns into
+
+  // run...
+  trun = usec();
+  if (debug == 2) pstart(pc, vsz);
+#if C4_JIT
+#include "c4_jit.h"
+#endif
+  if (jit && !debug) { printf("-j needs a C4_JIT build (x86-64)\n"); return -1; }
+#if C4_THREADED
+#include "c4_threaded.h"
+#endif
+  if (tos && debug != 1) { printf("-r needs a C4_THREADED build\n"); return -1; }
+  if (zc && !debug) { printf("-z needs a C4_THREADED build\n"); return -1; }
+  if (debug == 3) { printf("-P needs a C4_THREADED build\n"); return -1; }
+  vm(c, -1);
+  return c[VExit];
+}
+
+// -t runs the program once per line of stdin like -f, but in this process:
+// the VM contexts take turns on the portable interpreter, t cycles at a
+// time, until each exits or uses up the -c limit.  A context has its own
+// stack and its own copy of the globals, which is swapped into the data
+// area when its turn comes; the literals and the guest heap are shared,
+// and the output is flushed at the end of every turn.
+
+void dcopy(char *s, int o) // copy the data chunks out to s (o set) or back in from it
+{
+  int *d, n;
+
+  d = dcl;
+  while (d < dcp) {
+    n = d[1] - d[0];
+    if (o) memcpy(s, (char *)d[0], n); else memcpy((char *)d[0], s, n);
+    s = s + n; d = d + 2;
+  }
+}
+
+int sched(int *x, int *pc, char *name) // -t: the program at pc in context x once per line of stdin, taking turns
+{
+  char *b, *o, *s, **av;
+  int *cx, *c, *cur, i, k, n, m, live, ds;
+
+  use(x);
+  m = 4096; n = 0; // all of stdin first
+  if (!(b = malloc(m))) { printf("could not malloc(%d) request area\n", m); return -1; }
+  while ((i = read(0, b + n, m - 1 - n)) > 0) {
+    if ((n = n + i) == m - 1) { o = b; b = grow(b, n, m * 2); free(o); m = m * 2; }
+  }
+  b[n] = 0;
+  k = 0; s = b; while (*s) { if (*s == '\n' || !s[1]) ++k; ++s; }
+  dcp[-1] = (int)data; ds = 0; cx = dcl;
+  while (cx < dcp) { ds = ds + cx[1] - cx[0]; cx = cx + 2; }
+  if (!(cx = malloc(k * Vsz * sizeof(int) + 1))) { printf("could not malloc(%d) contexts\n", k * Vsz * sizeof(int)); return -1; }
+
+  s = b; i = 0;
+  while (i < k) { // the words of each line after name, and an empty environment
+    o = s; while (*o && *o != '\n') ++o;
+    if (!(av = malloc(((o - s) / 2 + 4) * sizeof(char *))) || !(o = malloc(vsz)) || !(cx[i * Vsz + VDat] = (int)malloc(ds + 1))) {
+      printf("could not malloc(%d) context %d\n", vsz + ds, i); return -1;
+    }
+    av[0] = name; n = 1;
+    while (*s && *s != '\n') {
+      while (*s == ' ' || *s == '\t') *s++ = 0;
+      if (*s && *s != '\n') av[n++] = s;
+      while (*s && *s != ' ' && *s != '\t' && *s != '\n') ++s;
+    }
+    if (*s) *s++ = 0;
+    av[n] = av[n + 1] = 0;
+    c = cx + i * Vsz;
+    vinit(c, pc, (int *)o, vsz, n, av);
+    dcopy((char *)c[VDat], 1); // the globals as the program starts
+    ++i;
+  }
+
+  live = k; cur = 0; i = 0; // cur: the context whose globals the data area holds
+  while (live) {
+    if (i >= live) i = 0;
+    c = cx + i * Vsz;
+    if (c != cur) { if (cur) dcopy((char *)cur[VDat], 1); dcopy((char *)c[VDat], 0); cur = c; }
+    n = sq; if (clim && clim - c[VCyc] < n) n = clim - c[VCyc];
+    n = vm(c, n);
+    oflush();
+    if (n && clim && c[VCyc] >= clim) { printf("cycle limit reached, cycle = %d\n", c[VCyc]); n = 0; }
+    if (n) ++i;
+    else { // the last context takes the place of the one that ended
+      free((char *)c[VStk]); free((char *)c[VDat]);
+      --live; cur = 0;
+      if (c != cx + live * Vsz) memcpy(c, cx + live * Vsz, Vsz * sizeof(int));
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int fd, stksz, *c, *pc, i, n, nf;
+  char **env, *out;
+
+  out = 0;
+  stksz = 256*1024; // VM stack, -m<KiB> or C4_STACK=<KiB>
+  env = argv + argc + 1; // the environment follows argv (System V process layout)
+  while (*env) { if (prefix(*env, "C4_STACK=") && decimal(*env + 9)) stksz = decimal(*env + 9) * 1024; ++env; }
+
+  --argc; ++argv;
+  while (argc > 0 && **argv == '-' && (*argv)[1]) {
+    if ((*argv)[1] == 's') src = 1;
+    else if ((*argv)[1] == 'd') debug = 1;
+    else if ((*argv)[1] == 'p') debug = 2;
+    else if ((*argv)[1] == 'P' && argc > 1) { debug = 3; fold = *++argv; --argc; }
+    else if ((*argv)[1] == 'r') tos = 1;
+    else if ((*argv)[1] == 'j') jit = 1;
+    else if ((*argv)[1] == 'z') zc = 1;
+    else if ((*argv)[1] == 'O') opt = 1;
+    else if ((*argv)[1] == 'i') { inl = decimal(*argv + 2); if (!inl) inl = 24; }
+    else if ((*argv)[1] == 'k') keep = 1;
+    else if ((*argv)[1] == 'f') srv = 1;
+    else if ((*argv)[1] == 't') { sq = decimal(*argv + 2); if (!sq) sq = 10000; }
+    else if ((*argv)[1] == 'c' && decimal(*argv + 2)) clim = decimal(*argv + 2);
+    else if ((*argv)[1] == 'm' && decimal(*argv + 2)) stksz = decimal(*argv + 2) * 1024;
+    else if ((*argv)[1] == 'o' && argc > 1) { out = *++argv; --argc; }
+    else if (prefix(*argv, "--stats=")) stats = *argv + 8;
+    else argc = 0;
+    --argc; ++argv;
+  }
+  nf = 1; i = 0; // the source files: the arguments up to a "--", or just the first one
+  while (i < argc && !streq(argv[i], "--")) ++i;
+  if (i < argc) nf = i;
+  if (argc < 1 || !nf) { printf("usage: c4 [-s] [-O] [-i<words>] [-d] [-p] [-P out.folded] [-r] [-z] [-j] [-k] [-f] [-t<cycles>] [-c<cycles>] [-m<KiB>] [-o out.c4b] [--stats=out.json] file|- [file ... --] ...\n"); return -1; }
+
+  if (!(c = cnew(stksz))) return -1;
+  tparse = usec();
+  pc = 0; i = 0;
+  while (i < nf) {
+    if (streq(argv[i], "-")) fd = 0; // source on stdin
+    else if ((fd = open(argv[i], 0)) < 0) { printf("could not open(%s)\n", argv[i]); return -1; }
+    n = load(fd);
+    if (fd) close(fd);
+    if (nf == 1 && n > 8 && !memcmp(p, "c4b-img\n", 8)) { if (!(pc = unpack(n))) return -1; } // compiled with -o
+    else if (compile(c, p, n, argv[i]) < 0) return -1;
+    ++i;
+  }
+  if (!pc) {
+    if (!(pc = build(c))) return -1;
+    if (src) { list(); return 0; }
+    if (out) return save(out, pc);
+  }
+  tparse = usec() - tparse;
+
+  if (nf < argc && streq(argv[nf], "--")) { argv[nf] = argv[0]; argc = argc - nf; argv = argv + nf; } // main() sees the first file and what follows --
+
+  if (sq) {
+    if (jit || tos || zc || debug) { printf("-t runs on the portable interpreter, without -j, -r, -z, -d, -p or -P\n"); return -1; }
+    if (stats) { printf("--stats describes a single run, it does not go with -t\n"); return -1; }
+    return sched(c, pc, *argv);
   }
+  if (srv) return serve(c, pc, *argv);
+  return run(c, pc, argc, argv);
 }
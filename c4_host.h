@@ -0,0 +1,182 @@
+// c4_host.h - host versions of the allocation and loading helpers in c4.c
+
+// Included in place of the portable zalloc() and load() when the host has
+// mmap.  c4 skips preprocessor lines, so a self-compiled c4 keeps using the
+// malloc/memset and read() versions.
+
+// Zeroed areas come from calloc, which takes fresh pages from the kernel
+// without touching them, so the symbol, hash and data chunks cost a page
+// fault when first used rather than a memset at startup.
+
+int run(int *x, int *pc, int argc, char **argv);
+
+char *zalloc(int n) { return calloc(1, n); }
+
+// Comments and # lines are skipped with strcspn(), which the C library
+// scans a vector at a time.
+
+char *eol(char *s) { return s + strcspn(s, "\n"); }
+
+// Output that has to stay in order with printf goes through stdio as well,
+// with fwrite() as it may hold NULs.
+
+void ostdio(char *s, int n) { fwrite(s, 1, n, stdout); }
+
+// Regular source files are mapped instead of copied, so a run no longer
+// reads the whole file through a buffer; the identifiers next() records in
+// id[Name] point into the mapping, which stays for the life of the process.
+// Pipes, ttys and anything mmap refuses go through slurp().
+//
+// next() stops at a NUL after the last byte.  The file is mapped over an
+// anonymous reservation one byte longer, so when the file ends exactly on a
+// page boundary that byte is a zero page rather than past the mapping.  The
+// mapping is private and writable so unpack() can relocate a c4b image in
+// place; only the pages it touches get copied.
+
+int load(int fd)
+{
+  struct stat st;
+  char *m;
+  int n;
+
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || (n = st.st_size) <= 0) return slurp(fd);
+  if ((m = mmap(0, n + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) return slurp(fd);
+  if (mmap(m, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) { munmap(m, n + 1); return slurp(fd); }
+  lp = p = m;
+  return n;
+}
+
+// The text and data of a compiled program are written out with every
+// absolute address turned into an offset, for unpack() to relocate.  Code
+// addresses are known from the opcode, data addresses from dtag: expr()
+// records each word it emits one into, and the passes after it carry the
+// mark along with the word.
+//
+// The string literals follow the data, starting on a page boundary of the
+// file.  unpack() only writes to the text, so when the image is mapped those
+// pages stay shared between every process running it.
+
+static int roff; // offset of the literals in the joined data
+
+int doff(int v) // offset of address v in the joined data, or -1
+{
+  int *c, o;
+
+  c = dcl; o = 0;
+  while (c < dcp) {
+    if (v >= c[0] && v < c[1]) return o + v - c[0];
+    o = o + ((c[1] - c[0] + 7) & -8);
+    c = c + 2;
+  }
+  c = rcl; o = roff;
+  while (c < rcp) {
+    if (v >= c[0] && v < c[1]) return o + v - c[0];
+    o = o + c[1] - c[0];
+    c = c + 2;
+  }
+  return -1;
+}
+
+int save(char *f, int *pc)
+{
+  int *c, *img, *w, *x, *r, n, m, i, v, fd;
+
+  dcp[-1] = (int)data;
+  n = e - text; m = 0; c = dcl;
+  while (c < dcp) { m = m + ((c[1] - c[0] + 7) & -8); c = c + 2; }
+  v = (6 + n + 1) * sizeof(int); // file offset of the data
+  m = roff = ((v + m + 4095) & -4096) - v;
+  c = rcl;
+  while (c < rcp) { m = m + c[1] - c[0]; c = c + 2; }
+  if (!(img = calloc(6 + n + 1 + m / sizeof(int) + n, sizeof(int)))) { printf("could not malloc image\n"); return -1; }
+  memcpy(img, "c4b-img\n", 8);
+  img[1] = imgv(); img[2] = n; img[3] = m; img[4] = pc - text;
+  w = img + 6; memcpy(w, text, (n + 1) * sizeof(int));
+  x = r = w + n + 1 + m / sizeof(int);
+  i = 1;
+  while (i < n) {
+    if (w[i] >= JMP && w[i] <= GEBZ) { w[i + 1] = (int *)w[i + 1] - text; *x++ = (i + 1) << 1; }
+    else if (w[i] <= ADJ && dtag[i + 1]) {
+      if ((v = doff(w[i + 1])) < 0) { printf("data address %d outside the data\n", w[i + 1]); return -1; }
+      w[i + 1] = v; *x++ = (i + 1) << 1 | 1;
+    }
+    i = i + (w[i] <= ADJ ? 2 : 1);
+  }
+  img[5] = x - r;
+  c = dcl;
+  while (c < dcp) { memcpy((char *)(w + n + 1) + doff(c[0]), (char *)c[0], c[1] - c[0]); c = c + 2; }
+  c = rcl;
+  while (c < rcp) { memcpy((char *)(w + n + 1) + doff(c[0]), (char *)c[0], c[1] - c[0]); c = c + 2; }
+
+  if ((fd = open(f, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) { printf("could not open(%s)\n", f); return -1; }
+  v = (x - img) * sizeof(int);
+  if (write(fd, img, v) != v) { printf("could not write(%s)\n", f); return -1; }
+  close(fd);
+  return 0;
+}
+
+// -f keeps the compiled program as a warm snapshot: each line on stdin runs
+// it in a child forked from the compiled state, with the words of the line
+// after argv[0].  The text, data and symbol pages are shared copy-on-write,
+// so a request pays for the fork and the run but not the compile.  The
+// child's stdin is /dev/null, the requests stay with the server.  A line
+// that does not fit the 4096 byte buffer is skipped, not split into two.
+
+int serve(int *x, int *pc, char *name)
+{
+  char *b, *s, **av;
+  int ac, pid, k;
+
+  if (!(b = malloc(4096)) || !(av = malloc(2051 * sizeof(char *)))) { printf("could not malloc serve area\n"); return -1; } // up to 2048 words, name and two 0s
+  while (fgets(b, 4096, stdin)) {
+    if (strlen(b) == 4095 && b[4094] != '\n') {
+      printf("request longer than 4094 bytes skipped\n");
+      while ((k = getchar()) != EOF && k != '\n') ;
+      continue;
+    }
+    av[0] = name; ac = 1; s = b;
+    while (*s) {
+      while (*s == ' ' || *s == '\t' || *s == '\n') *s++ = 0;
+      if (*s) av[ac++] = s;
+      while (*s && *s != ' ' && *s != '\t' && *s != '\n') ++s;
+    }
+    av[ac] = av[ac + 1] = 0; // and an empty environment
+    fflush(stdout);
+    if ((pid = fork()) < 0) { printf("could not fork\n"); return -1; }
+    if (!pid) {
+      close(0); open("/dev/null", O_RDONLY);
+      exit(run(x, pc, ac, av));
+    }
+    waitpid(pid, 0, 0);
+  }
+  return 0;
+}
+
+// --stats=path writes one JSON object when the program exits, for whatever
+// collects them: times, the cycle count (null under -j, which does not
+// count), how much of each area the program used and the guest heap
+// totals.  The stack depth is the deepest word run() finds overwritten in
+// the 0xA5 fill.
+
+int usec() { struct timeval t; gettimeofday(&t, 0); return t.tv_sec * 1000000 + t.tv_usec; }
+
+void wstats(int c, int x)
+{
+  FILE *f;
+  unsigned char *s;
+  int *d, n;
+
+  if (!(f = fopen(stats, "w"))) { printf("could not open(%s)\n", stats); return; }
+  dcp[-1] = (int)data; n = 0; d = dcl;
+  while (d < dcp) { n = n + d[1] - d[0]; d = d + 2; }
+  d = rcl; while (d < rcp) { n = n + d[1] - d[0]; d = d + 2; }
+  s = (unsigned char *)vs; while (s < (unsigned char *)vs + vsz && *s == 0xA5) ++s;
+  fprintf(f, "{\"exit\": %lld, \"parse_us\": %lld, \"run_us\": %lld, ", x, tparse, usec() - trun);
+  if (c < 0) fprintf(f, "\"cycles\": null, "); else fprintf(f, "\"cycles\": %lld, ", c);
+  fprintf(f, "\"pool_bytes\": %lld, \"text_bytes\": %lld, \"data_bytes\": %lld, \"symbols\": %lld, \"symbol_bytes\": %lld, ",
+    poolsz, (e + 1 - text) * sizeof(int), n, nsym, nsym * Idsz * sizeof(int));
+  fprintf(f, "\"stack_bytes\": %lld, \"stack_size\": %lld, ", (int)((unsigned char *)vs + vsz - s), vsz);
+  fprintf(f, "\"mallocs\": %lld, \"frees\": %lld, \"malloc_bytes\": %lld, \"live_bytes\": %lld, \"peak_bytes\": %lld, \"arena_bytes\": %lld}\n",
+    gst[0], gst[1], gst[2], gst[3], gst[4], gst[5]);
+  fclose(f);
+}
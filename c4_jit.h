@@ -0,0 +1,176 @@
+// c4_jit.h - template JIT for x86-64, selected with -j
+
+// Included twice like c4_threaded.h: at file scope it defines the compiler,
+// inside run() it runs the program on it.  Each opcode in the (already
+// peepholed) text area is copied out as a fixed machine code template, so
+// the dispatch disappears entirely and the VM registers live in host
+// registers:
+//
+//   a  = rax    sp = rbx    bp = rbp    rcx, rdx, rdi.. = scratch
+//
+// The VM stack is the same memory the interpreter uses, and JSR/LEV keep the
+// VM frame layout, only the return address pushed by JSR is a native one.
+// The native stack pointer is left alone (16-byte aligned by the entry
+// trampoline) so the library opcodes can call straight into libc.
+//
+// Only x86-64 is implemented; on other hosts -j reports that and the
+// interpreters are used as before.
+
+#ifndef C4_JIT_H
+#define C4_JIT_H
+
+int native(int i, int *sp, int n);
+void oflush();
+void wstats(int c, int x);
+
+static unsigned char *jp; // next byte of native code
+
+static void jb(char *s, int n) { memcpy(jp, s, n); jp = jp + n; } // emit a template
+static void j4(int v) { *(int32_t *)jp = v; jp = jp + 4; }
+static void j8(int v) { *(int64_t *)jp = v; jp = jp + 8; }
+
+int jitrun(int *pc, int *sp)
+{
+  static char cc[] = { // condition codes of EQ..GE for setcc/jcc
+    [EQ - EQ] = 0x4, [NE - EQ] = 0x5, [LT - EQ] = 0xC, [GT - EQ] = 0xF, [LE - EQ] = 0xE, [GE - EQ] = 0xD
+  };
+  static void *lib[] = { // called directly, narg has how many arguments each takes
+    [OPEN] = (void *)open, [CLOS] = (void *)close, [MSET] = (void *)memset, [MCMP] = (void *)memcmp,
+    [MCPY] = (void *)memcpy, [SLEN] = (void *)strlen
+  };
+  static char *argr[] = { // mov reg, [rbx + disp32] for rdi, rsi, rdx, rcx, r8, r9
+    "\x48\x8B\xBB", "\x48\x8B\xB3", "\x48\x8B\x93", "\x48\x8B\x8B", "\x4C\x8B\x83", "\x4C\x8B\x8B"
+  };
+  unsigned char *code, *epi, *ret;
+  int *r, *nat, *fx, *f, i, n, v, sz;
+
+  n = e + 1 - text;
+  sz = 64 * n + 4096; // no template is longer than 64 bytes per code word
+  code = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) { printf("could not mmap(%d) jit area\n", sz); return -1; }
+  if (!(nat = malloc(n * sizeof(int))) || !(fx = f = malloc(n * sizeof(int)))) {
+    printf("could not malloc(%d) jit tables\n", n * sizeof(int)); return -1;
+  }
+  jp = code;
+
+  // entry trampoline: jit code (rdi) runs on VM stack rsi, returns a in rax
+  jb("\x53\x55\x41\x54", 4);           // push rbx; push rbp; push r12 (realigns rsp)
+  jb("\x48\x89\xF3\xFF\xE7", 5);       // mov rbx, rsi; jmp rdi
+  epi = jp;
+  jb("\x41\x5C\x5D\x5B\xC3", 5);       // pop r12; pop rbp; pop rbx; ret
+  ret = jp;                            // main() returns here: exit(a)
+  jb("\xE9", 1); j4(epi - (jp + 4));
+
+  r = text;
+  while (r < e) {
+    nat[r + 1 - text] = jp - code;
+    i = *++r;
+    if (i <= ADJ) v = *++r;
+    if      (i == LEA) { jb("\x48\x8D\x85", 3); j4(v * sizeof(int)); }
+    else if (i == IMM) {
+      if (v == (int32_t)v) { jb("\x48\xC7\xC0", 3); j4(v); }
+      else { jb("\x48\xB8", 2); j8(v); }
+    }
+    else if (i == LLI) { jb("\x48\x8B\x85", 3); j4(v * sizeof(int)); }
+    else if (i == LLC) { jb("\x48\x0F\xBE\x85", 4); j4(v * sizeof(int)); }
+    else if (i == LGI) { jb("\x48\xB8", 2); j8(v); jb("\x48\x8B\x00", 3); }
+    else if (i == LGC) { jb("\x48\xB8", 2); j8(v); jb("\x48\x0F\xBE\x00", 4); }
+    else if (i >= ADDI && i <= MULI) {
+      if (i == MULI && v > 1 && !(v & v - 1)) { // power of two: shl rax, k
+        n = 0; while (v >> n != 1) ++n;
+        jb("\x48\xC1\xE0", 3); *jp++ = n;
+      }
+      else if (v != (int32_t)v) { jb("\x48\xB9", 2); j8(v); jb(i == ADDI ? "\x48\x01\xC8" : i == SUBI ? "\x48\x29\xC8" : "\x48\x0F\xAF\xC1", i == MULI ? 4 : 3); }
+      else { jb(i == ADDI ? "\x48\x05" : i == SUBI ? "\x48\x2D" : "\x48\x69\xC0", i == MULI ? 3 : 2); j4(v); }
+    }
+    else if (i == JMP) { jb("\xE9", 1); *f++ = jp - code; *f++ = v; j4(0); }
+    else if (i == JSR) {
+      jb("\x48\x8D\x0D\x0C\x00\x00\x00", 7); // lea rcx, [rip + 12]: after the jmp
+      jb("\x48\x83\xEB\x08\x48\x89\x0B", 7); // sub rbx, 8; mov [rbx], rcx
+      jb("\xE9", 1); *f++ = jp - code; *f++ = v; j4(0);
+    }
+    else if (i == TJSR) { // the arguments over ours, then jump as if our caller made the call
+      n = 0;
+      while (n < r[2]) { jb("\x48\x8B\x8B", 3); j4(n * sizeof(int)); jb("\x48\x89\x8D", 3); j4((n + 2) * sizeof(int)); ++n; }
+      jb("\x48\x8D\x5D\x08\x48\x8B\x6D\x00", 8); // lea rbx, [rbp + 8]; mov rbp, [rbp]
+      jb("\xE9", 1); *f++ = jp - code; *f++ = v; j4(0);
+    }
+    else if (i == BZ || i == BNZ) {
+      jb(i == BZ ? "\x48\x85\xC0\x0F\x84" : "\x48\x85\xC0\x0F\x85", 5); // test rax, rax; jz/jnz
+      *f++ = jp - code; *f++ = v; j4(0);
+    }
+    else if (i >= EQBZ && i <= GEBZ) {
+      jb("\x48\x89\xC1\x48\x8B\x03\x48\x83\xC3\x08\x48\x39\xC8", 13); // pop into rax, cmp rax, rcx
+      jb("\x0F", 1); *jp++ = 0x90 + cc[i - EQBZ]; jb("\xC0\x0F\xB6\xC0", 4); // setcc al; movzx eax, al
+      jb("\x0F", 1); *jp++ = 0x80 + (cc[i - EQBZ] ^ 1);                   // j!cc
+      *f++ = jp - code; *f++ = v; j4(0);
+    }
+    else if (i == JTAB) { // every JMP after it is 5 bytes
+      jb("\x48\xC7\xC1", 3); j4(v);                  // mov rcx, n
+      jb("\x48\x39\xC8\x48\x0F\x43\xC1", 7);        // cmp rax, rcx; cmovae rax, rcx: the default
+      jb("\x48\x8D\x0C\x80\x48\x8D\x15\x05\x00\x00\x00", 11); // lea rcx, [rax + 4 * rax]; lea rdx, [rip + 5]
+      jb("\x48\x01\xD1\xFF\xE1", 5);               // add rcx, rdx; jmp rcx
+    }
+    else if (i == ENT) {
+      jb("\x48\x83\xEB\x08\x48\x89\x2B\x48\x89\xDD", 10); // push rbp; mov rbp, rbx
+      jb("\x48\x81\xEB", 3); j4(v * sizeof(int));
+    }
+    else if (i == ADJ) { jb("\x48\x81\xC3", 3); j4(v * sizeof(int)); }
+    else if (i == LEV) jb("\x48\x89\xEB\x48\x8B\x2B\x48\x8B\x4B\x08\x48\x83\xC3\x10\xFF\xE1", 16);
+    else if (i == LI)  jb("\x48\x8B\x00", 3);
+    else if (i == LC)  jb("\x48\x0F\xBE\x00", 4);
+    else if (i == SI)  jb("\x48\x8B\x0B\x48\x83\xC3\x08\x48\x89\x01", 10);
+    else if (i == SC)  jb("\x48\x8B\x0B\x48\x83\xC3\x08\x88\x01\x48\x0F\xBE\xC0", 13);
+    else if (i == PSH) jb("\x48\x83\xEB\x08\x48\x89\x03", 7);
+    else if (i == NOT) jb("\x48\x85\xC0\x0F\x94\xC0\x0F\xB6\xC0", 9);
+    else if (i >= OR && i <= MOD) {
+      jb("\x48\x89\xC1\x48\x8B\x03\x48\x83\xC3\x08", 10); // rcx = a, rax = popped operand
+      if      (i == OR)  jb("\x48\x09\xC8", 3);
+      else if (i == XOR) jb("\x48\x31\xC8", 3);
+      else if (i == AND) jb("\x48\x21\xC8", 3);
+      else if (i <= GE) {
+        jb("\x48\x39\xC8\x0F", 4); *jp++ = 0x90 + cc[i - EQ]; jb("\xC0\x0F\xB6\xC0", 4);
+      }
+      else if (i == SHL) jb("\x48\xD3\xE0", 3);
+      else if (i == SHR) jb("\x48\xD3\xF8", 3);
+      else if (i == ADD) jb("\x48\x01\xC8", 3);
+      else if (i == SUB) jb("\x48\x29\xC8", 3);
+      else if (i == MUL) jb("\x48\x0F\xAF\xC1", 4);
+      else if (i == DIV) jb("\x48\x99\x48\xF7\xF9", 5);
+      else               jb("\x48\x99\x48\xF7\xF9\x48\x89\xD0", 8);
+    }
+    else if (i == NAT && (v == PRTF || v == PUTC || v == READ || v == WRIT || v == MALC || v == FREE)) { // output buffer and guest heap
+      jb("\x48\xC7\xC7", 3); j4(v);          // mov rdi, i
+      jb("\x48\x89\xDE\x48\xC7\xC2", 6); j4(r[2]); // mov rsi, rbx; mov rdx, argument count
+      jb("\x49\xBB", 2); j8((int)native);  // mov r11, native
+      jb("\x41\xFF\xD3", 3);              // call r11
+    }
+    else if (i == NAT) {
+      i = v; v = narg[i] - '0'; // argument n sits at sp[v - 1 - n]
+      n = 0;
+      while (n < v) { jb(argr[n], 3); j4((v - 1 - n) * sizeof(int)); ++n; }
+      jb("\x49\xBB", 2); j8((int)lib[i]); // mov r11, fn
+      jb("\x41\xFF\xD3", 3);              // call r11
+      if (i == OPEN || i == CLOS || i == MCMP) jb("\x48\x63\xC0", 3); // int result
+    }
+    else if (i == EXIT) { jb("\x48\x8B\x03\xE9", 4); j4(epi - (jp + 4)); }
+    else { printf("unknown instruction = %d\n", i); return -1; }
+  }
+
+  while (fx < f) { // resolve branch targets now that every address is known
+    *(int32_t *)(code + *fx) = nat[(int *)fx[1] - text] - (*fx + 4);
+    fx = fx + 2;
+  }
+  if (mprotect(code, sz, PROT_READ | PROT_EXEC)) { printf("could not mprotect jit area\n"); return -1; }
+
+  *sp = (int)ret; // main()'s return address
+  i = ((int (*)(void *, int *))code)(code + nat[pc - text], sp);
+  oflush();
+  if (stats) wstats(-1, i);
+  printf("exit(%d)\n", i);
+  return i;
+}
+
+#else
+  if (jit && !debug) return jitrun(pc, sp);
+#endif
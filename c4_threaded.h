@@ -0,0 +1,429 @@
+// c4_threaded.h - direct-threaded dispatch for the VM loop in vm()
+
+// Included twice when C4_THREADED is set: at file scope it defines the
+// engine, inside run() it hands the program over to it.  c4 skips
+// preprocessor lines, so a self-compiled c4 never sees this file and simply
+// runs the portable switch in vm().
+
+// By default the text area is translated once in place: every opcode word is
+// overwritten with the address of its handler, operands and code addresses
+// stay where they are, so each instruction then costs one indirect jump
+// instead of the switch's bounds check and table jump.  The -d tracer needs
+// the original opcodes and keeps using the switch.
+
+// For -p every opcode word is threaded to L_PROF instead, which counts the
+// opcode kept in a copy of the text area and then jumps on to its handler.
+// The plain handlers stay as they are, so profiling costs nothing unless it
+// is asked for.
+
+// -P samples instead: a SIGPROF timer handler threads every opcode word to
+// L_SAMP, so whatever runs next records pc and the return addresses along
+// the bp chain into a ring buffer and threads the text back.  A stack too
+// deep for a sample keeps pc and the outermost frames, with a "..." frame
+// for the ones left out, so it still starts at main.  Between ticks the code
+// runs at full speed.  At exit the samples are written as collapsed
+// stacks (function:line;... count), the input of flamegraph.pl.
+
+// With -r the code is instead translated into a separate buffer for a
+// stack-caching engine: besides a (the top of stack) the next stack slot is
+// kept in b.  The translator tracks statically whether b is live, picks the
+// OR1.. variants that pop b instead of memory, and spills b (SPL) before
+// anything that reads the memory stack or is a jump target, so every branch
+// lands with b empty.  A PSH only goes to b when a look-ahead finds that it
+// is popped by such a variant; pushes feeding calls stay in memory.
+
+// -z translates into 32-bit words instead, halving the text the engine
+// walks through: handlers are offsets from the first one, branches are
+// relative word offsets, and operands that need more than 32 bits (global
+// addresses, big constants) go to a pool of 64-bit words, which the IMMK..
+// variants load from.  Return addresses on the VM stack stay full pointers.
+
+#ifndef C4_THREADED_H
+#define C4_THREADED_H
+
+void pcall(int *f, int c);
+void pret(int c);
+void preport(int c);
+int idlen(char *m);
+int native(int i, int *sp, int n);
+void oflush();
+int pline(int *a);
+void wstats(int c, int x);
+
+#define RING  4096 // samples kept for -P, the oldest are overwritten
+#define DEPTH 32   // words per sample: frame count, pc and return sites (0: the deeper ones left out)
+
+static int *ring, rn, *sops; // samples, how many were taken, original opcodes
+static void *sl;             // &&L_SAMP
+
+static void sthread(void **op) // thread every opcode word to its handler in op, or to L_SAMP
+{
+  int *t, i;
+
+  t = text;
+  while (t < e) { i = sops[++t - text]; *t = (int)(op ? op[i] : sl); if (i <= ADJ) ++t; }
+}
+
+static void stick(int sig) { sthread(0); }
+
+static void stimer(int us) // tick every us microseconds of cpu time, 0 stops
+{
+  struct itimerval v;
+
+  v.it_interval.tv_sec = 0; v.it_interval.tv_usec = us; v.it_value = v.it_interval;
+  setitimer(ITIMER_PROF, &v, 0);
+}
+
+static void sframe(FILE *f, int **fn, int *a) // function:line of code word a
+{
+  int *d;
+
+  if (!a) { fputs("...", f); return; }
+  if ((d = fn[a - text])) fprintf(f, "%.*s", idlen((char *)d[Name]), (char *)d[Name]);
+  else fprintf(f, "@%d", a - text);
+  if (lines) fprintf(f, ":%d", pline(a));
+}
+
+static void sdump() // write the samples in the ring to fold
+{
+  FILE *f;
+  int **fn, *d, *r, i, k, n;
+
+  n = e - text + 1;
+  if (!(fn = calloc(n, sizeof(int *)))) { printf("could not malloc(%d) sample names\n", n * sizeof(int)); return; }
+  if (!(f = fopen(fold, "w"))) { printf("could not open(%s)\n", fold); free(fn); return; }
+  i = 0; // function entry covering each code word
+  while (i <= hmask) {
+    if ((d = (int *)htab[i]) && d[Class] == Fun && (int *)d[Val] >= text && (int *)d[Val] <= e) fn[(int *)d[Val] - text] = d;
+    ++i;
+  }
+  i = 1; while (i < n) { if (!fn[i]) fn[i] = fn[i - 1]; ++i; }
+
+  k = rn > RING ? rn - RING : 0;
+  while (k < rn) {
+    r = ring + k++ % RING * DEPTH;
+    i = *r; // outermost frame first
+    while (i) { sframe(f, fn, (int *)r[i]); if (--i) fputc(';', f); }
+    fprintf(f, " 1\n");
+  }
+  fclose(f); free(fn);
+}
+
+int threaded(int *pc, int *sp, int *bp, int *t) // t: exit stub main() returns into
+{
+  static void *op[] = {
+    [LEA] = &&L_LEA, [IMM] = &&L_IMM, [LLI] = &&L_LLI, [LLC] = &&L_LLC, [LGI] = &&L_LGI, [LGC] = &&L_LGC,
+    [ADDI] = &&L_ADDI, [SUBI] = &&L_SUBI, [MULI] = &&L_MULI,
+    [JMP] = &&L_JMP, [JSR] = &&L_JSR, [TJSR] = &&L_TJSR, [BZ]  = &&L_BZ,  [BNZ] = &&L_BNZ,
+    [EQBZ] = &&L_EQBZ, [NEBZ] = &&L_NEBZ, [LTBZ] = &&L_LTBZ, [GTBZ] = &&L_GTBZ, [LEBZ] = &&L_LEBZ, [GEBZ] = &&L_GEBZ,
+    [NAT] = &&L_NAT, [JTAB] = &&L_JTAB, [ENT] = &&L_ENT, [ADJ] = &&L_ADJ, [LEV] = &&L_LEV, [LI]  = &&L_LI,  [LC]  = &&L_LC,  [SI]  = &&L_SI,
+    [SC]  = &&L_SC,  [PSH] = &&L_PSH, [NOT] = &&L_NOT,
+    [OR]  = &&L_OR,  [XOR] = &&L_XOR, [AND] = &&L_AND, [EQ]  = &&L_EQ,  [NE]  = &&L_NE,  [LT]  = &&L_LT,
+    [GT]  = &&L_GT,  [LE]  = &&L_LE,  [GE]  = &&L_GE,  [SHL] = &&L_SHL, [SHR] = &&L_SHR, [ADD] = &&L_ADD,
+    [SUB] = &&L_SUB, [MUL] = &&L_MUL, [DIV] = &&L_DIV, [MOD] = &&L_MOD, [EXIT] = &&L_EXIT
+  };
+  static void *op1[EXIT + 1] = { // variants taking the second operand from b
+    [EQBZ] = &&L_EQBZ1, [NEBZ] = &&L_NEBZ1, [LTBZ] = &&L_LTBZ1, [GTBZ] = &&L_GTBZ1, [LEBZ] = &&L_LEBZ1, [GEBZ] = &&L_GEBZ1,
+    [SI]  = &&L_SI1,  [SC]  = &&L_SC1,
+    [OR]  = &&L_OR1,  [XOR] = &&L_XOR1, [AND] = &&L_AND1, [EQ]  = &&L_EQ1,  [NE]  = &&L_NE1,  [LT]  = &&L_LT1,
+    [GT]  = &&L_GT1,  [LE]  = &&L_LE1,  [GE]  = &&L_GE1,  [SHL] = &&L_SHL1, [SHR] = &&L_SHR1, [ADD] = &&L_ADD1,
+    [SUB] = &&L_SUB1, [MUL] = &&L_MUL1, [DIV] = &&L_DIV1, [MOD] = &&L_MOD1
+  };
+  int a, b, cycle, i, *tc, *tg, *nw, *fx, *r, *w, *f, *q, s, n, c, *ops, *st;
+
+  // thread the exit stub that main() returns into
+  t[0] = (int)op[PSH]; t[1] = (int)op[EXIT]; st = t; // VM frames lie below st
+
+  if (debug >= 2) {
+    n = e - text + 1;
+    if (!(ops = malloc(n * sizeof(int)))) { printf("could not malloc(%d) profile area\n", n * sizeof(int)); return -1; }
+    memcpy(ops, text, n * sizeof(int));
+    t = text;
+    while (t < e) { i = *++t; *t = (int)(debug == 2 ? &&L_PROF : op[i]); if (i <= ADJ) ++t; }
+    if (debug == 3) {
+      if (!(ring = malloc(RING * DEPTH * sizeof(int)))) { printf("could not malloc(%d) sample ring\n", RING * DEPTH * sizeof(int)); return -1; }
+      sops = ops; sl = &&L_SAMP;
+      signal(SIGPROF, (void *)stick); // its int is long long here
+      stimer(1000);
+    }
+  }
+  else if (!tos) {
+    t = text;
+    while (t < e) { i = *++t; *t = (int)op[i]; if (i <= ADJ) ++t; }
+  }
+  else {
+    n = e - text + 2;
+    if (!(tc = malloc(2 * n * sizeof(int))) || !(tg = malloc(n * sizeof(int))) ||
+        !(nw = malloc(n * sizeof(int))) || !(fx = malloc(n * sizeof(int)))) {
+      printf("could not malloc(%d) stack-caching code\n", 2 * n * sizeof(int)); return -1;
+    }
+    memset(tg, 0, n * sizeof(int));
+    r = text;
+    while (r < e) {
+      i = *++r;
+      if (i >= JMP && i <= GEBZ) tg[(int *)r[1] - text] = 1;
+      if (i == JSR) tg[r + 2 - text] = 1;
+      if (i <= ADJ) ++r;
+    }
+
+    r = text + 1; w = tc; f = fx; s = 0; // s: b holds the next stack slot
+    while (r <= e) {
+      i = *r;
+      if (tg[r - text] && s) { *w++ = (int)&&L_SPL; s = 0; }
+      nw[r - text] = w - tc;
+      if (i == PSH) {
+        q = r; n = 1; c = 0; // find what pops this value, within a few straight-line ops
+        while (n && !c && q < r + 32 && !tg[++q - text]) {
+          if (*q == PSH) ++n;
+          else if (op1[*q]) --n;
+          else if (*q > MULI && *q != LI && *q != LC && *q != NOT) c = 1;
+          if (*q <= ADJ) ++q;
+        }
+        if (n) *w++ = (int)(s ? &&L_PSH2 : op[PSH]);
+        else *w++ = (int)(s ? &&L_PSH1 : &&L_PSH0);
+        s = !n;
+      }
+      else if (s && op1[i]) { *w++ = (int)op1[i]; s = 0; }
+      else if (i == LEV) { *w++ = (int)op[i]; s = 0; }
+      else if (i > MULI && i != LI && i != LC && i != NOT) {
+        if (s) { *w++ = (int)&&L_SPL; s = 0; } // reads or moves the memory stack
+        *w++ = (int)op[i];
+      }
+      else *w++ = (int)op[i];
+      if (i <= ADJ) {
+        if (i >= JMP && i <= GEBZ) *f++ = w - tc;
+        *w++ = r[1]; ++r;
+      }
+      ++r;
+    }
+    while (f > fx) { --f; tc[*f] = (int)(tc + nw[(int *)tc[*f] - text]); }
+    pc = tc + nw[pc - text];
+    free(tg); free(nw); free(fx);
+  }
+
+#define NEXT ++cycle; goto *(void *)*pc++
+
+  cycle = 0;
+  NEXT;
+  L_LEA: a = (int)(bp + *pc++);                             NEXT; // load local address
+  L_IMM: a = *pc++;                                         NEXT; // load global address or immediate
+  L_LLI: a = *(bp + *pc++);                                 NEXT; // load local int
+  L_LLC: a = *(char *)(bp + *pc++);                         NEXT; // load local char
+  L_LGI: a = *(int *)*pc++;                                 NEXT; // load global int
+  L_LGC: a = *(char *)*pc++;                                NEXT; // load global char
+  L_ADDI: a = a + *pc++;                                    NEXT; // add immediate
+  L_SUBI: a = a - *pc++;                                    NEXT; // subtract immediate
+  L_MULI: a = a * *pc++;                                    NEXT; // multiply immediate
+  L_JMP: pc = (int *)*pc;                                   NEXT; // jump
+  L_JSR: *--sp = (int)(pc + 1); pc = (int *)*pc;            NEXT; // jump to subroutine
+  L_TJSR: memcpy(bp + 2, sp, pc[2] * sizeof(int)); sp = bp + 1; bp = (int *)*bp; pc = (int *)*pc; NEXT; // tail call
+  L_BZ:  pc = a ? pc + 1 : (int *)*pc;                      NEXT; // branch if zero
+  L_BNZ: pc = a ? (int *)*pc : pc + 1;                      NEXT; // branch if not zero
+  L_EQBZ: pc = (a = *sp++ == a) ? pc + 1 : (int *)*pc;     NEXT; // compare and branch if false
+  L_NEBZ: pc = (a = *sp++ != a) ? pc + 1 : (int *)*pc;     NEXT;
+  L_LTBZ: pc = (a = *sp++ <  a) ? pc + 1 : (int *)*pc;     NEXT;
+  L_GTBZ: pc = (a = *sp++ >  a) ? pc + 1 : (int *)*pc;     NEXT;
+  L_LEBZ: pc = (a = *sp++ <= a) ? pc + 1 : (int *)*pc;     NEXT;
+  L_GEBZ: pc = (a = *sp++ >= a) ? pc + 1 : (int *)*pc;     NEXT;
+  L_ENT: *--sp = (int)bp; bp = sp; sp = sp - *pc++;         NEXT; // enter subroutine
+  L_ADJ: sp = sp + *pc++;                                   NEXT; // stack adjust
+  L_LEV: sp = bp; bp = (int *)*sp++; pc = (int *)*sp++;     NEXT; // leave subroutine
+  L_LI:  a = *(int *)a;                                     NEXT; // load int
+  L_LC:  a = *(char *)a;                                    NEXT; // load char
+  L_SI:  *(int *)*sp++ = a;                                 NEXT; // store int
+  L_SC:  a = *(char *)*sp++ = a;                            NEXT; // store char
+  L_PSH: *--sp = a;                                         NEXT; // push
+  L_NOT: a = !a;                                            NEXT; // logical not
+
+  L_OR:  a = *sp++ |  a; NEXT;
+  L_XOR: a = *sp++ ^  a; NEXT;
+  L_AND: a = *sp++ &  a; NEXT;
+  L_EQ:  a = *sp++ == a; NEXT;
+  L_NE:  a = *sp++ != a; NEXT;
+  L_LT:  a = *sp++ <  a; NEXT;
+  L_GT:  a = *sp++ >  a; NEXT;
+  L_LE:  a = *sp++ <= a; NEXT;
+  L_GE:  a = *sp++ >= a; NEXT;
+  L_SHL: a = *sp++ << a; NEXT;
+  L_SHR: a = *sp++ >> a; NEXT;
+  L_ADD: a = *sp++ +  a; NEXT;
+  L_SUB: a = *sp++ -  a; NEXT;
+  L_MUL: a = *sp++ *  a; NEXT;
+  L_DIV: a = *sp++ /  a; NEXT;
+  L_MOD: a = *sp++ %  a; NEXT;
+
+  L_NAT: a = native(*pc, sp, pc[2]); ++pc; NEXT; // call library function
+  L_JTAB: pc = pc + 1 + 2 * ((uint64_t)a < (uint64_t)*pc ? a : *pc); NEXT; // indexed jump through the JMPs after it
+  L_EXIT:
+    oflush();
+    if (debug == 2) preport(cycle);
+    if (debug == 3) { stimer(0); sdump(); }
+    if (stats) wstats(cycle, *sp);
+    printf("exit(%d) cycle = %d\n", *sp, cycle); return *sp;
+
+  L_PROF: // -p: count, then run the original opcode
+    i = ops[pc - 1 - text]; ++popc[i];
+    if (i == JSR) pcall((int *)*pc, cycle); else if (i == LEV) pret(cycle);
+    else if (i == TJSR) { pret(cycle); pcall((int *)*pc, cycle); }
+    goto *op[i];
+
+  L_SAMP: // -P: a timer tick, record the stack before running the opcode
+    sthread(op);
+    r = ring + rn++ % RING * DEPTH; n = 1; r[1] = (int)(pc - 1);
+    i = 0; q = bp; while (q < st && (int *)q[1] > text && (int *)q[1] <= e + 1) { ++i; q = (int *)*q; } // frames around pc
+    q = bp;
+    if (i > DEPTH - 2) { r[++n] = 0; while (i > DEPTH - 3) { q = (int *)*q; --i; } } // too deep: keep the outermost ones
+    while (i--) { r[++n] = (int)((int *)q[1] - 1); q = (int *)*q; }
+    *r = n;
+    goto *op[ops[pc - 1 - text]];
+
+  // stack-caching variants, only reached from code translated for -r
+  L_SPL:  *--sp = b;                                        NEXT; // spill b
+  L_PSH0: b = a;                                            NEXT; // push into empty b
+  L_PSH1: *--sp = b; b = a;                                 NEXT; // push with b live
+  L_PSH2: *--sp = b; *--sp = a;                             NEXT; // spill b and push to memory
+  L_SI1:  *(int *)b = a;                                    NEXT;
+  L_SC1:  a = *(char *)b = a;                               NEXT;
+  L_EQBZ1: pc = (a = b == a) ? pc + 1 : (int *)*pc;        NEXT;
+  L_NEBZ1: pc = (a = b != a) ? pc + 1 : (int *)*pc;        NEXT;
+  L_LTBZ1: pc = (a = b <  a) ? pc + 1 : (int *)*pc;        NEXT;
+  L_GTBZ1: pc = (a = b >  a) ? pc + 1 : (int *)*pc;        NEXT;
+  L_LEBZ1: pc = (a = b <= a) ? pc + 1 : (int *)*pc;        NEXT;
+  L_GEBZ1: pc = (a = b >= a) ? pc + 1 : (int *)*pc;        NEXT;
+
+  L_OR1:  a = b |  a; NEXT;
+  L_XOR1: a = b ^  a; NEXT;
+  L_AND1: a = b &  a; NEXT;
+  L_EQ1:  a = b == a; NEXT;
+  L_NE1:  a = b != a; NEXT;
+  L_LT1:  a = b <  a; NEXT;
+  L_GT1:  a = b >  a; NEXT;
+  L_LE1:  a = b <= a; NEXT;
+  L_GE1:  a = b >= a; NEXT;
+  L_SHL1: a = b << a; NEXT;
+  L_SHR1: a = b >> a; NEXT;
+  L_ADD1: a = b +  a; NEXT;
+  L_SUB1: a = b -  a; NEXT;
+  L_MUL1: a = b *  a; NEXT;
+  L_DIV1: a = b /  a; NEXT;
+  L_MOD1: a = b %  a; NEXT;
+
+#undef NEXT
+}
+
+int compact(int *pc, int *sp, int *bp)
+{
+  static void *op[] = {
+    [LEA] = &&Z_LEA, [IMM] = &&Z_IMM, [LLI] = &&Z_LLI, [LLC] = &&Z_LLC, [LGI] = 0, [LGC] = 0,
+    [ADDI] = &&Z_ADDI, [SUBI] = &&Z_SUBI, [MULI] = &&Z_MULI,
+    [JMP] = &&Z_JMP, [JSR] = &&Z_JSR, [TJSR] = &&Z_TJSR, [BZ]  = &&Z_BZ,  [BNZ] = &&Z_BNZ,
+    [EQBZ] = &&Z_EQBZ, [NEBZ] = &&Z_NEBZ, [LTBZ] = &&Z_LTBZ, [GTBZ] = &&Z_GTBZ, [LEBZ] = &&Z_LEBZ, [GEBZ] = &&Z_GEBZ,
+    [NAT] = &&Z_NAT, [JTAB] = &&Z_JTAB, [ENT] = &&Z_ENT, [ADJ] = &&Z_ADJ, [LEV] = &&Z_LEV, [LI]  = &&Z_LI,  [LC]  = &&Z_LC,  [SI]  = &&Z_SI,
+    [SC]  = &&Z_SC,  [PSH] = &&Z_PSH, [NOT] = &&Z_NOT,
+    [OR]  = &&Z_OR,  [XOR] = &&Z_XOR, [AND] = &&Z_AND, [EQ]  = &&Z_EQ,  [NE]  = &&Z_NE,  [LT]  = &&Z_LT,
+    [GT]  = &&Z_GT,  [LE]  = &&Z_LE,  [GE]  = &&Z_GE,  [SHL] = &&Z_SHL, [SHR] = &&Z_SHR, [ADD] = &&Z_ADD,
+    [SUB] = &&Z_SUB, [MUL] = &&Z_MUL, [DIV] = &&Z_DIV, [MOD] = &&Z_MOD, [EXIT] = &&Z_EXIT
+  };
+  static void *opk[EXIT + 1] = { // variants taking the operand from the pool
+    [IMM] = &&Z_IMMK, [LGI] = &&Z_LGIK, [LGC] = &&Z_LGCK, [ADDI] = &&Z_ADDK, [SUBI] = &&Z_SUBK, [MULI] = &&Z_MULK
+  };
+  int32_t *cz, *w, *z;
+  int a, cycle, i, v, n, *r, *nw, *fx, *f, *kp, *k;
+
+  n = e - text + 1;
+  if (!(cz = malloc((n + 2) * sizeof(int32_t))) || !(nw = malloc(n * sizeof(int))) ||
+      !(fx = malloc(n * sizeof(int))) || !(kp = malloc(n * sizeof(int)))) {
+    printf("could not malloc(%d) compact code\n", n * sizeof(int)); return -1;
+  }
+#define ZOP(l) (int32_t)((char *)(l) - (char *)&&Z_LEA)
+  cz[0] = ZOP(op[PSH]); cz[1] = ZOP(op[EXIT]); // the exit stub main() returns into
+  *sp = (int)cz;
+  r = text; w = cz + 2; f = fx; k = kp;
+  while (r < e) {
+    nw[r + 1 - text] = w - cz;
+    i = *++r;
+    if (i <= ADJ) v = *++r;
+    if (i >= JMP && i <= GEBZ) { *w++ = ZOP(op[i]); *f++ = w - cz; *w++ = (int *)v - text; }
+    else if (opk[i] && (!op[i] || v != (int32_t)v)) { *w++ = ZOP(opk[i]); *w++ = k - kp; *k++ = v; }
+    else if (i <= ADJ && v != (int32_t)v) { printf("operand %d too wide for -z\n", v); return -1; }
+    else { *w++ = ZOP(op[i]); if (i <= ADJ) *w++ = v; }
+  }
+  while (f > fx) { --f; cz[*f] = nw[cz[*f]] - *f; } // relative to the operand word
+  pc = (int *)(cz + nw[pc - text]);
+  z = (int32_t *)pc;
+  free(nw); free(fx);
+
+#define NEXT ++cycle; goto *(void *)((char *)&&Z_LEA + *z++)
+
+  cycle = 0;
+  NEXT;
+  Z_LEA: a = (int)(bp + *z++);                              NEXT;
+  Z_IMM: a = *z++;                                          NEXT;
+  Z_LLI: a = *(bp + *z++);                                  NEXT;
+  Z_LLC: a = *(char *)(bp + *z++);                          NEXT;
+  Z_ADDI: a = a + *z++;                                     NEXT;
+  Z_SUBI: a = a - *z++;                                     NEXT;
+  Z_MULI: a = a * *z++;                                     NEXT;
+  Z_JMP: z = z + *z;                                        NEXT;
+  Z_JSR: *--sp = (int)(z + 1); z = z + *z;                  NEXT;
+  Z_TJSR: memcpy(bp + 2, sp, z[2] * sizeof(int)); sp = bp + 1; bp = (int *)*bp; z = z + *z; NEXT;
+  Z_BZ:  z = a ? z + 1 : z + *z;                            NEXT;
+  Z_BNZ: z = a ? z + *z : z + 1;                            NEXT;
+  Z_EQBZ: z = (a = *sp++ == a) ? z + 1 : z + *z;           NEXT;
+  Z_NEBZ: z = (a = *sp++ != a) ? z + 1 : z + *z;           NEXT;
+  Z_LTBZ: z = (a = *sp++ <  a) ? z + 1 : z + *z;           NEXT;
+  Z_GTBZ: z = (a = *sp++ >  a) ? z + 1 : z + *z;           NEXT;
+  Z_LEBZ: z = (a = *sp++ <= a) ? z + 1 : z + *z;           NEXT;
+  Z_GEBZ: z = (a = *sp++ >= a) ? z + 1 : z + *z;           NEXT;
+  Z_ENT: *--sp = (int)bp; bp = sp; sp = sp - *z++;          NEXT;
+  Z_ADJ: sp = sp + *z++;                                    NEXT;
+  Z_LEV: sp = bp; bp = (int *)*sp++; z = (int32_t *)*sp++;  NEXT;
+  Z_LI:  a = *(int *)a;                                     NEXT;
+  Z_LC:  a = *(char *)a;                                    NEXT;
+  Z_SI:  *(int *)*sp++ = a;                                 NEXT;
+  Z_SC:  a = *(char *)*sp++ = a;                            NEXT;
+  Z_PSH: *--sp = a;                                         NEXT;
+  Z_NOT: a = !a;                                            NEXT;
+
+  Z_OR:  a = *sp++ |  a; NEXT;
+  Z_XOR: a = *sp++ ^  a; NEXT;
+  Z_AND: a = *sp++ &  a; NEXT;
+  Z_EQ:  a = *sp++ == a; NEXT;
+  Z_NE:  a = *sp++ != a; NEXT;
+  Z_LT:  a = *sp++ <  a; NEXT;
+  Z_GT:  a = *sp++ >  a; NEXT;
+  Z_LE:  a = *sp++ <= a; NEXT;
+  Z_GE:  a = *sp++ >= a; NEXT;
+  Z_SHL: a = *sp++ << a; NEXT;
+  Z_SHR: a = *sp++ >> a; NEXT;
+  Z_ADD: a = *sp++ +  a; NEXT;
+  Z_SUB: a = *sp++ -  a; NEXT;
+  Z_MUL: a = *sp++ *  a; NEXT;
+  Z_DIV: a = *sp++ /  a; NEXT;
+  Z_MOD: a = *sp++ %  a; NEXT;
+
+  Z_NAT: a = native(*z, sp, z[2]); ++z; NEXT; // the ADJ after it has the argument count
+  Z_JTAB: z = z + 1 + 2 * ((uint64_t)a < (uint64_t)*z ? a : *z); NEXT; // every JMP after it is two words too
+  Z_EXIT:
+    oflush();
+    if (stats) wstats(cycle, *sp);
+    printf("exit(%d) cycle = %d\n", *sp, cycle); return *sp;
+
+  // operands from the pool
+  Z_IMMK: a = kp[*z++];                                     NEXT;
+  Z_LGIK: a = *(int *)kp[*z++];                             NEXT;
+  Z_LGCK: a = *(char *)kp[*z++];                            NEXT;
+  Z_ADDK: a = a + kp[*z++];                                 NEXT;
+  Z_SUBK: a = a - kp[*z++];                                 NEXT;
+  Z_MULK: a = a * kp[*z++];                                 NEXT;
+
+#undef NEXT
+#undef ZOP
+}
+
+#else
+
+if (zc && !debug && !tos) return compact(pc, sp, bp);
+if (debug != 1) return threaded(pc, sp, bp, t);
+
+#endif
@@ -0,0 +1,7 @@
+// a constant division that would trap is left for the run, not folded
+int main(int argc, char **argv)
+{
+  if (argc > 5) printf("%d %d\n", (-9223372036854775807 - 1) / -1, (-9223372036854775807 - 1) % -1);
+  printf("%d %d %d\n", (-9223372036854775807 - 1) / 1, 7 / -1, -7 % -1);
+  return 0;
+}
@@ -0,0 +1,12 @@
+// calls to a small leaf function inside while and for loops, for -i
+int sq(int x) { return x * x; }
+
+int main()
+{
+  int i, s;
+  i = 0; s = 0;
+  while (i < 1000) { s = s + sq(i); i++; }
+  for (i = 0; i < 100; i++) s = s - sq(i);
+  printf("%d\n", s);
+  return 0;
+}
@@ -0,0 +1,13 @@
+// malloc() of a negative size fails, as the host's does
+int main()
+{
+  char *p;
+
+  p = malloc(16);
+  printf("%d %d\n", malloc(-100) == 0, malloc(-1) == 0);
+  free(p);
+  p = malloc(16);
+  *p = 1;
+  printf("%d\n", *p);
+  return 0;
+}
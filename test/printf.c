@@ -0,0 +1,14 @@
+// printf() conversions and flags, to compare with the host's printf()
+int main()
+{
+  int m;
+
+  m = -1;
+  printf("[%+d] [%o] [% d] [%#x] [%.3d] [%u]\n", 5, 8, 3, 255, 5, 7);
+  printf("[%d] [%i] [%5d] [%-5d|] [%05d] [%+05d] [% 5d] [%.0d] [%5.3d] [%-+6.2d|]\n", -42, 0, 42, 42, -42, 42, 42, 0, -7, 7);
+  printf("[%lu] [%lu] [%lx] [%X] [%lo] [%#o] [%#.0o] [%#X] [%#08x] [%#x]\n", m, 4000000000, m, 3054, m, 8, 0, 255, 255, 0);
+  printf("[%lld] [%ld] [%ld] [%+d]\n", -9223372036854775807 - 1, 9223372036854775807, -9223372036854775807 - 1, 0);
+  printf("[%s] [%8s] [%-8s|] [%.2s] [%*d] [%-*d|] [%.*d] [%c] [%3c] [%%] [%5%]\n", "abc", "abc", "abc", "abc", 6, 1, 6, 1, 4, 2, 'x', 'y');
+  printf("[%p] [%p] [%12p] [%-12p|]\n", 0, 4096, 4096, 4096);
+  return 0;
+}
@@ -0,0 +1,99 @@
+#!/bin/sh
+# run.sh - regression checks for c4
+#
+# usage: test/run.sh [c4 binary]
+#
+# Runs c4 (default ./c4, build it first with gcc -O2 -o c4 c4.c) on the
+# programs next to this script and compares what they print with what they
+# should.  Prints each check that fails and exits 1 if any did.
+
+c4=${1:-./c4}
+dir=$(cd "$(dirname "$0")" && pwd)
+fail=0
+
+cycles() { "$c4" "$@" | tail -1 | sed 's/.*cycle = //'; } # c4 arguments
+
+check() { # what, expected output without the exit line's cycle count, c4 arguments
+  what=$1; want=$2; shift 2
+  got=$("$c4" "$@" 2>&1 | sed 's/ cycle = [0-9]*$//')
+  [ "$got" = "$want" ] && return
+  printf '%s: c4 %s\n  want: %s\n  got:  %s\n' "$what" "$*" "$want" "$got"
+  fail=1
+}
+
+# -i inlines the calls in loop bodies, which sit after the jump to the test
+for f in "" -i -O "-i -O" "-i -r" "-i -z"; do
+  check "inline_loop $f" "332505150
+exit(0)" $f "$dir/inline_loop.c"
+done
+"$c4" -i -s "$dir/inline_loop.c" | grep -q "inlined sq() at 2 call sites" || { echo "inline_loop: -s does not list sq() inlined at 2 call sites"; fail=1; }
+[ "$(cycles -i "$dir/inline_loop.c")" -lt "$(cycles "$dir/inline_loop.c")" ] || { echo "inline_loop: -i does not save cycles"; fail=1; }
+
+# no TJSR where a parameter's or local's address may outlive the frame, TJSR elsewhere
+for f in "" -r -z -O -i; do
+  check "tail_call $f" "7 70 5000050000
+exit(0)" $f "$dir/tail_call.c"
+done
+
+# case values too far apart for a jump table, where their span overflows an int
+for f in "" -O -r; do
+  check "switch_wide $f" "1 2 3 4 5 0
+exit(0)" $f "$dir/switch_wide.c"
+done
+
+# malloc() of a negative size returns 0 rather than a block
+for f in "" -k; do
+  check "malloc_neg $f" "1 1
+1
+exit(0)" $f "$dir/malloc_neg.c"
+done
+
+# printf() as the host's libc prints it, with c4's int as long
+tmp=${TMPDIR:-/tmp}/c4test.$$
+if { echo '#include <stdio.h>'; echo '#define int long'; cat "$dir/printf.c"; } > "$tmp.c" && ${CC:-cc} -w -o "$tmp" "$tmp.c" 2>/dev/null; then
+  for f in "" -O; do
+    check "printf $f" "$("$tmp")
+exit(0)" $f "$dir/printf.c"
+  done
+else
+  echo "printf: skipped, no host C compiler"
+fi
+rm -f "$tmp" "$tmp.c"
+
+# the smallest int / -1 is not folded, it traps only when it runs
+for f in "" -O -r; do
+  check "fold_div $f" "-9223372036854775808 -7 0
+exit(0)" $f "$dir/fold_div.c"
+done
+
+# -P keeps the outermost frames of a stack too deep for a sample, marking the gap
+tmp=${TMPDIR:-/tmp}/c4test.$$
+if "$c4" -P "$tmp" "$dir/sample_deep.c" > /dev/null 2>&1; then
+  [ -s "$tmp" ] && ! grep -v '^main:[0-9]*;\(rec:[0-9]*;\)*\.\.\.;rec:[0-9]* 1$' "$tmp" > /dev/null ||
+    { echo "sample_deep: c4 -P stacks not rooted at main:"; head -3 "$tmp"; fail=1; }
+else
+  echo "sample_deep: skipped, no -P in this build"
+fi
+rm -f "$tmp"
+
+# -f runs each request line that fits its buffer, and skips (not splits) a longer one
+got=$(awk 'BEGIN { for (i = 0; i < 2047; ++i) printf "a "; print ""; for (i = 0; i < 5000; ++i) printf "x"; print ""; print "1 2 3" }' |
+  "$c4" -f "$dir/serve_args.c" 2>&1 | sed 's/ cycle = [0-9]*$//')
+want="2048 a
+exit(0)
+request longer than 4094 bytes skipped
+4 3
+exit(0)"
+[ "$got" = "$want" ] || { printf 'serve_args: c4 -f\n  want: %s\n  got:  %s\n' "$want" "$got"; fail=1; }
+
+# a context holds every global of c4.c: each one declared is listed in gvars()
+decl=$(awk '/^(char|int) \*(p, \*lp|e, \*le),/ { on = 1 } on { sub(/\/\/.*/, ""); print } on && /;/ { on = 0 }' "$dir/../c4.c" |
+  tr ',;' '\n\n' | sed -e 's/^ *char //' -e 's/^ *int //' -e 's/[ *]//g' | grep . | sort)
+held=$(sed -n '/^void gvars()/,/^}/p' "$dir/../c4.c" | grep -o '&[a-z_]*' | tr -d '&' | sort)
+for g in $decl; do
+  echo "$held" | grep -qx "$g" || { echo "gvars: global $g is not in a context"; fail=1; }
+done
+[ -n "$decl" ] || { echo "gvars: found no globals in c4.c"; fail=1; }
+
+[ $fail = 0 ] && echo "all checks passed"
+exit $fail
@@ -0,0 +1,16 @@
+// -P on a call stack deeper than a sample holds
+int rec(int n)
+{
+  int i, s;
+
+  if (n) return rec(n - 1) + 1;
+  s = 0; i = 0;
+  while (i < 10000000) { s = s + i; ++i; }
+  return s;
+}
+
+int main()
+{
+  printf("%d\n", rec(100));
+  return 0;
+}
@@ -0,0 +1,6 @@
+// prints how many words its request line had and the last one
+int main(int argc, char **argv)
+{
+  printf("%d %s\n", argc, argv[argc - 1]);
+  return 0;
+}
@@ -0,0 +1,18 @@
+// a switch whose case values span the whole int range
+int f(int v)
+{
+  switch (v) {
+  case -0x7fffffffffffffff: return 1;
+  case -5: return 2;
+  case 0: return 3;
+  case 5: return 4;
+  case 0x7fffffffffffffff: return 5;
+  }
+  return 0;
+}
+
+int main()
+{
+  printf("%d %d %d %d %d %d\n", f(-0x7fffffffffffffff), f(-5), f(0), f(5), f(0x7fffffffffffffff), f(1));
+  return 0;
+}
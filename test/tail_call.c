@@ -0,0 +1,19 @@
+// return f(...) as a tail call, and where it must not be one
+int g(int *p) { return *p; }
+
+int f(int a) { return g(&a); } // &a is still in use in g()
+
+int h(int a)
+{
+  int x;
+  x = a * 10;
+  return g(&x);
+}
+
+int sum(int n, int s) { if (!n) return s; return sum(n - 1, s + n); } // deeper than the stack without TJSR
+
+int main()
+{
+  printf("%d %d %d\n", f(7), h(7), sum(100000, 0));
+  return 0;
+}